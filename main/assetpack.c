@@ -0,0 +1,133 @@
+#include "assetpack.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+
+static const char *TAG = "tes-assets";
+
+static const uint8_t *pack;
+static const asset_pack_header_t *header;
+static const uint16_t *buckets;
+static const asset_pack_slot_t *slots;
+
+// must match fnv1a() in tools/mkassetpack.py
+static uint32_t fnv1a(uint32_t seed, const char *data, size_t len)
+{
+	uint32_t h = 2166136261u ^ seed;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (uint8_t)data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * @brief
+ * Uses an asset image that is already in memory. Only the tables are checked;
+ * asset contents are served straight out of the image.
+ *
+ * @param[in] image  Start of the image, 4-byte aligned
+ * @param[in] size   Bytes available at `image`
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG if the image is malformed
+ */
+esp_err_t asset_pack_open(const uint8_t *image, size_t size)
+{
+	const asset_pack_header_t *hdr = (const asset_pack_header_t *)image;
+	size_t buckets_len;
+
+	if (size < sizeof(*hdr) || hdr->magic != ASSET_PACK_MAGIC || hdr->version != ASSET_PACK_VERSION)
+		return ESP_ERR_INVALID_ARG;
+
+	buckets_len = (hdr->num_buckets * sizeof(uint16_t) + 3) & ~3;
+	if (hdr->size > size || hdr->num_buckets == 0 || hdr->num_slots == 0 ||
+		sizeof(*hdr) + buckets_len + hdr->num_slots * sizeof(asset_pack_slot_t) > hdr->size)
+		return ESP_ERR_INVALID_ARG;
+
+	pack = image;
+	header = hdr;
+	buckets = (const uint16_t *)(image + sizeof(*hdr));
+	slots = (const asset_pack_slot_t *)(image + sizeof(*hdr) + buckets_len);
+	return ESP_OK;
+}
+
+/**
+ * @brief
+ * Memory-maps the asset image in the given data partition, mapping only as
+ * much flash as the image occupies.
+ *
+ * @param[in] label  Partition label, e.g. "www"
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t asset_pack_init(const char *label)
+{
+	const esp_partition_t *part;
+	asset_pack_header_t hdr;
+	spi_flash_mmap_handle_t handle;
+	const void *image;
+	esp_err_t ret;
+
+	part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+	if (!part)
+		return ESP_ERR_NOT_FOUND;
+
+	ret = esp_partition_read(part, 0, &hdr, sizeof(hdr));
+	if (ret != ESP_OK)
+		return ret;
+	if (hdr.magic != ASSET_PACK_MAGIC || hdr.size > part->size)
+	{
+		ESP_LOGE(TAG, "No asset image in partition %s", label);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	ret = esp_partition_mmap(part, 0, hdr.size, SPI_FLASH_MMAP_DATA, &image, &handle);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = asset_pack_open(image, hdr.size);
+	if (ret != ESP_OK)
+	{
+		spi_flash_munmap(handle);
+		return ret;
+	}
+
+	ESP_LOGI(TAG, "Mapped %u assets (%u bytes) from %s", header->count, header->size, label);
+	return ESP_OK;
+}
+
+/**
+ * @brief
+ * Looks up an asset by request path with one hash per table level and a
+ * single string compare to reject paths that are not in the pack.
+ *
+ * @param[in]  path      Request path, e.g. "/index.html"
+ * @param[in]  path_len  Length of `path`, so query strings can be cut off
+ * @param[out] data      Asset contents inside the mapped image
+ * @param[out] len       Asset length
+ *
+ * @return true if the asset exists
+ */
+bool asset_pack_find(const char *path, size_t path_len, const char **data, size_t *len)
+{
+	const asset_pack_slot_t *slot;
+	uint16_t d;
+
+	if (!pack)
+		return false;
+
+	d = buckets[fnv1a(header->seed, path, path_len) % header->num_buckets];
+	slot = &slots[fnv1a(d, path, path_len) % header->num_slots];
+
+	if (slot->path_len != path_len || memcmp(pack + slot->path_off, path, path_len) != 0)
+		return false;
+
+	*data = (const char *)(pack + slot->data_off);
+	*len = slot->data_len;
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// image layout, see tools/mkassetpack.py
+#define ASSET_PACK_MAGIC   0x50575757   // "WWWP"
+#define ASSET_PACK_VERSION 1
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint16_t num_slots;
+	uint16_t num_buckets;
+	uint32_t seed;
+	uint32_t size;
+} asset_pack_header_t;
+
+typedef struct
+{
+	uint32_t path_off;
+	uint16_t path_len;   // 0 for an empty slot
+	uint16_t reserved;
+	uint32_t data_off;
+	uint32_t data_len;
+} asset_pack_slot_t;
+
+esp_err_t asset_pack_init(const char *label);
+esp_err_t asset_pack_open(const uint8_t *image, size_t size);
+bool asset_pack_find(const char *path, size_t path_len, const char **data, size_t *len);
+
+#endif
@@ -1,24 +1,36 @@
 #include "comm.h"
+#include "device.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/uart.h"
 #include "string.h"
 
 static const int RX_BUF_SIZE = 1024;
 static const char *TAG = "tes-uart";
 
-int uart_enabled;
+#define BAUD_RATE     115200
+// start, 8 data, parity and stop bits
+#define BYTE_BITS     11
+// time one frame takes on the wire (us)
+#define FRAME_TIME_US ((int64_t)PACKET_LEN * BYTE_BITS * 1000000 / BAUD_RATE)
+// time the given number of bytes take on the wire (us)
+#define BYTES_TIME_US(n) ((int64_t)(n) * BYTE_BITS * 1000000 / BAUD_RATE)
 
-ADCSdata packet_global;
-// int num_packets;
-
-void init_uart(void)
+/**
+ * @brief
+ * Installs and configures the device's UART driver. Only the receive task
+ * calls this, so the driver never changes under a read in progress.
+ *
+ * @return ESP_OK, or the error of the step that failed; the link stays disabled
+ */
+static esp_err_t init_uart(adcs_dev_t *dev)
 {
 	const uart_config_t uart_config = {
-        .baud_rate = 115200,
+        .baud_rate = BAUD_RATE,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_ODD,
         .stop_bits = UART_STOP_BITS_1,
@@ -26,98 +38,445 @@ void init_uart(void)
         .source_clk = UART_SCLK_APB,
     };
     // We won't use a buffer for sending data.
-    uart_driver_install(UART_NUM_1, RX_BUF_SIZE * 2, 0, 0, NULL, 0);
-    uart_param_config(UART_NUM_1, &uart_config);
-    uart_set_pin(UART_NUM_1, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    esp_err_t ret = uart_driver_install(dev->uart, RX_BUF_SIZE * 2, 0, 20, &dev->uart_queue, 0);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(TAG, "ADCS %d: UART %d driver install failed: %s", dev->id, dev->uart, esp_err_to_name(ret));
+		dev->uart_queue = NULL;
+		return ret;
+	}
 
-	uart_enabled = 1;
+    ret = uart_param_config(dev->uart, &uart_config);
+	if (ret == ESP_OK)
+		ret = uart_set_pin(dev->uart, dev->txd_pin, dev->rxd_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(TAG, "ADCS %d: UART %d setup failed: %s", dev->id, dev->uart, esp_err_to_name(ret));
+		uart_driver_delete(dev->uart);
+		dev->uart_queue = NULL;
+		return ret;
+	}
 
-	// xTaskCreate(rx_task, "uart_rx_task", 1024*2, NULL, configMAX_PRIORITIES, NULL);
+	dev->enabled = 1;
+	return ESP_OK;
 }
 
-void disable_uart(void)
+static void disable_uart(adcs_dev_t *dev)
 {
-	uart_enabled = 0;
-	uart_driver_delete(UART_NUM_1);
+	dev->enabled = 0;
+	xQueueReset(dev->cmd_queue);
+	uart_driver_delete(dev->uart);
+	dev->uart_queue = NULL;
+
+	portENTER_CRITICAL(&dev->lock);
+	flow_reset(&dev->flow, esp_timer_get_time());
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+/**
+ * @brief
+ * Asks a device's receive task to bring its link up or down and waits for the
+ * outcome. The receive task owns the UART driver, so REST handlers never
+ * install or delete it themselves.
+ *
+ * @param[in] dev     Device to change
+ * @param[in] enable  1 to install the UART driver, 0 to remove it
+ *
+ * @return ESP_OK, the UART driver error, or ESP_ERR_TIMEOUT if the receive
+ *         task did not answer
+ */
+esp_err_t set_link_enabled(adcs_dev_t *dev, int enable)
+{
+	esp_err_t ret;
+
+	// a late answer to an earlier request that timed out
+	// must not be taken for this one
+	xQueueReset(dev->link_result);
+	xQueueOverwrite(dev->link_request, &enable);
+
+	if (xQueueReceive(dev->link_result, &ret, ADCS_LINK_TIMEOUT_MS / portTICK_RATE_MS) != pdTRUE)
+		return ESP_ERR_TIMEOUT;
+	return ret;
+}
+
+/**
+ * @brief
+ * Carries out a pending set_link_enabled() request, if there is one.
+ */
+static void handle_link_request(adcs_dev_t *dev)
+{
+	esp_err_t ret = ESP_OK;
+	int enable;
+
+	if (xQueueReceive(dev->link_request, &enable, 0) != pdTRUE)
+		return;
+
+	if (enable && !dev->enabled)
+	{
+		// drop anything that slipped in while the link was going down
+		xQueueReset(dev->cmd_queue);
+		ret = init_uart(dev);
+	}
+	else if (!enable && dev->enabled)
+		disable_uart(dev);
+
+	xQueueOverwrite(dev->link_result, &ret);
+}
+
+/**
+ * @brief
+ * Queues a command for a device. The command is written by the device's
+ * receive task, so callers never touch the UART directly. Commands for a
+ * link that is down are refused rather than held until it comes back up.
+ * 
+ * @param[in] dev  Device to command
+ * @param[in] cmd  Command value
+ * 
+ * @return Number of bytes that will be sent, or -1 if the link is down or the
+ *         queue is full
+ */
+int send_command(adcs_dev_t *dev, uint8_t cmd)
+{
+	if (!dev->enabled)
+	{
+		ESP_LOGW(TAG, "ADCS %d link is down, dropped 0x%02x", dev->id, cmd);
+		return -1;
+	}
+	if (xQueueSend(dev->cmd_queue, &cmd, 0) != pdTRUE)
+	{
+		ESP_LOGW(TAG, "ADCS %d command queue full, dropped 0x%02x", dev->id, cmd);
+		return -1;
+	}
+	return COMMAND_LEN;
 }
 
-int send_command(uint8_t cmd)
+static int write_command(adcs_dev_t *dev, uint8_t cmd)
 {
 	TEScommand packet;
 	packet._command = cmd;
 	packet._crc = 0;
 
     const int len = COMMAND_LEN;
-    const int txBytes = uart_write_bytes(UART_NUM_1, packet._data, len);
-    ESP_LOGI(TAG, "Wrote %d bytes", txBytes);
+    const int txBytes = uart_write_bytes(dev->uart, packet._data, len);
+    ESP_LOGI(TAG, "ADCS %d: wrote %d bytes", dev->id, txBytes);
+	dev->stats.tx_commands++;
     return txBytes;
 }
 
+/**
+ * @brief
+ * Rolls the per-period counters into rates once a stats period has elapsed.
+ */
+static void update_stats(adcs_dev_t *dev, int64_t now)
+{
+	adcs_stats_t *st = &dev->stats;
+	int64_t elapsed = now - st->period_start;
+
+	if (elapsed < ADCS_STATS_PERIOD_US)
+		return;
+
+	portENTER_CRITICAL(&dev->lock);
+	st->rx_bytes_per_sec = (uint32_t)((int64_t)st->period_bytes * 1000000 / elapsed);
+	st->rx_frames_per_sec = (uint32_t)((int64_t)st->period_frames * 1000000 / elapsed);
+	st->cpu_permille = (uint32_t)(st->period_busy * 1000 / elapsed);
+	st->client_requests_per_sec = (uint32_t)((int64_t)st->period_requests * 1000000 / elapsed);
+	st->client_send_permille = (uint32_t)(st->period_send * 1000 / elapsed);
+	st->period_start = now;
+	st->period_busy = 0;
+	st->period_bytes = 0;
+	st->period_frames = 0;
+	st->period_send = 0;
+	st->period_requests = 0;
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+/**
+ * @brief
+ * Checks the UART driver's events for FIFO or ring overflows. After one, the
+ * ring no longer lines up with frame boundaries, so it is flushed and the
+ * flushed bytes are counted as dropped.
+ *
+ * @return 1 if the ring was flushed, 0 otherwise
+ */
+static int check_overflow(adcs_dev_t *dev)
+{
+	uart_event_t event;
+	size_t buffered = 0;
+	int overflow = 0;
+
+	while (xQueueReceive(dev->uart_queue, &event, 0) == pdTRUE)
+	{
+		if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+			overflow = 1;
+	}
+	if (!overflow)
+		return 0;
+
+	uart_get_buffered_data_len(dev->uart, &buffered);
+	uart_flush_input(dev->uart);
+	xQueueReset(dev->uart_queue);
+
+	dev->flow.overflows++;
+	dev->flow.dropped_bytes += buffered;
+	ESP_LOGW(TAG, "ADCS %d: receive overflow, flushed %d bytes", dev->id, (int)buffered);
+	return 1;
+}
+
+/**
+ * @brief
+ * Recomputes link pressure and sends the ADCS a rate change if the flow
+ * controller asks for one.
+ *
+ * @param[in,out] dev         Device to update
+ * @param[in]     ring_bytes  Bytes waiting in the UART ring before this poll's read
+ * @param[in]     now         esp_timer time (us)
+ */
+static void update_flow(adcs_dev_t *dev, size_t ring_bytes, int64_t now)
+{
+	int ring_fill;
+	int client;
+	int send;
+	int cmd;
+
+	ring_fill = ring_bytes * 100 / (RX_BUF_SIZE * 2);
+	client = dev->client_backlog * 100 / ADCS_CLIENT_BACKLOG_MAX;
+	send = dev->stats.client_send_permille / 10;
+	if (send > client)
+		client = send;
+
+	cmd = flow_update(&dev->flow, ring_fill, client, dev->stats.cpu_permille / 10,
+		dev->stats.rx_frames_per_sec, now);
+	if (cmd >= 0)
+		write_command(dev, cmd);
+}
+
+static uint16_t frame_status(const uint8_t *frame)
+{
+	return frame[0] | (frame[1] << 8);
+}
+
+/**
+ * @brief
+ * Checks whether a frame starts at the given byte. Neither side fills in the
+ * CRC yet, so a frame is recognised by its status word, which must be one of
+ * enum Status.
+ */
+static int frame_start_valid(const uint8_t *frame)
+{
+	switch (frame_status(frame))
+	{
+		case STATUS_OK:
+		case STATUS_HELLO:
+		case STATUS_ADCS_ERROR:
+		case STATUS_COMM_ERROR:
+		case STATUS_FUDGED:
+		case STATUS_TEST_START:
+		case STATUS_TEST_END:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * @brief
+ * Stricter check used to regain sync after a slip. A lone status word is too
+ * weak there: STATUS_FUDGED is 0x0000, which any two zero bytes inside a frame
+ * match. So the candidate must carry a non-zero status and the next frame
+ * must start right after it.
+ *
+ * @param[in] frame  Candidate start, with PACKET_LEN + 2 bytes available
+ */
+static int frame_start_confirmed(const uint8_t *frame)
+{
+	return frame_status(frame) != STATUS_FUDGED &&
+		frame_start_valid(frame) && frame_start_valid(frame + PACKET_LEN);
+}
+
+/**
+ * @brief
+ * Decodes one frame. Alarm rules and test statistics see every frame; only
+ * publishing to clients is subject to flow-control decimation.
+ *
+ * @param[in,out] dev    Device that received the frame
+ * @param[in]     frame  PACKET_LEN bytes of the frame
+ * @param[in]     seq    Sequence number to give the frame
+ * @param[in]     time   When the frame's last byte arrived (us)
+ */
+static void handle_frame(adcs_dev_t *dev, const uint8_t *frame, int seq, int64_t time)
+{
+	ADCSdata packet;
+	rule_event_t fired[RULE_MAX];
+	int num_fired;
+	int i;
+
+	packet._seq = seq;
+	packet._time = time;
+
+	for (i = 0; i < PACKET_LEN; i++)
+	{
+		packet._data[i] = frame[i];
+	}
+
+	// evaluate alarms before anything else so a safety
+	// action goes out within one poll period of the frame;
+	// logging and notifying clients wait until it is on the wire
+	if (rules_process(&dev->rules, &packet, fired, &num_fired) & RULE_ACTION_DESATURATE)
+		write_command(dev, CMD_DESATURATE);
+	rules_dispatch(&dev->rules, fired, num_fired);
+
+	test_stats_process(&dev->test, &packet);
+
+	if (flow_should_publish(&dev->flow, time))
+		device_publish(dev, &packet);
+
+	dev->stats.rx_frames++;
+	dev->stats.period_frames++;
+
+	// ESP_LOGI(TAG, "Sequence: %d", packet._seq);
+
+	// if (packet._status == STATUS_OK)
+	// 	ESP_LOGI(TAG, "Status: OK");
+	// if (packet._status == STATUS_HELLO)
+	// 	ESP_LOGI(TAG, "Status: HELLO");
+	// if (packet._status == STATUS_COMM_ERROR)
+	// 	ESP_LOGI(TAG, "Status: COMM ERROR");
+	// if (packet._status == STATUS_ADCS_ERROR)
+	// 	ESP_LOGI(TAG, "Status: SYSTEM ERROR");
+
+	// ESP_LOGI(TAG, "Voltage: %f", fixedToFloat(packet._voltage));
+	// ESP_LOGI(TAG, "Current: %d", packet._current);
+	// ESP_LOGI(TAG, "Motor speed: %d", packet._speed);
+	// ESP_LOGI(TAG, "Mag X: %d", packet._magX);
+	// ESP_LOGI(TAG, "Mag Y: %d", packet._magY);
+	// ESP_LOGI(TAG, "Mag Z: %d", packet._magZ);
+	// ESP_LOGI(TAG, "Gyro X: %f", fixedToFloat(packet._gyroX));
+	// ESP_LOGI(TAG, "Gyro Y: %f", fixedToFloat(packet._gyroY));
+	// ESP_LOGI(TAG, "Gyro Z: %f", fixedToFloat(packet._gyroZ));
+}
+
+/**
+ * @brief
+ * Receive pipeline for one ADCS link: drains the command queue, decodes every
+ * complete frame read from the UART and keeps flow control up to date. A
+ * partial frame is kept for the next read, unless the line goes quiet for
+ * longer than a frame takes to send. A quiet line also means the next byte
+ * starts a frame. Once a frame start fails to validate, bytes are skipped one
+ * at a time until frame_start_confirmed() finds the stream lined up again.
+ * One instance runs per device, with the device passed as the task argument.
+ */
 void rx_task(void *arg)
 {
-	// ADCSdata packet;
+	adcs_dev_t *dev = (adcs_dev_t *)arg;
 	uint8_t *data = (uint8_t *)malloc(RX_BUF_SIZE + 1);
-	int seq = 0;
-	int i;
-	int rxBytesCopy;
+	int pending = 0;
+	int synced = 1;
+	int64_t last_rx = 0;
+	int seq = 1;   // 0 marks a device that has not received anything yet
+	int skipped;
+	int off;
+	uint8_t cmd;
 
-	// num_packets = 0;
+	dev->stats.period_start = esp_timer_get_time();
+	dev->flow.since = dev->flow.last_change = dev->stats.period_start;
 
 	while (1)
 	{
-		if(uart_enabled)
+		int64_t start = esp_timer_get_time();
+
+		handle_link_request(dev);
+
+		if (dev->enabled)
 		{
-			const int rxBytes = uart_read_bytes(UART_NUM_1, data, RX_BUF_SIZE, 0);
+			while (xQueueReceive(dev->cmd_queue, &cmd, 0) == pdTRUE)
+				write_command(dev, cmd);
+
+			if (check_overflow(dev))
+			{
+				// the UART keeps receiving, so the next byte is rarely a frame start
+				dev->flow.dropped_bytes += pending;
+				pending = 0;
+				synced = 0;
+			}
 
-			rxBytesCopy = rxBytes;
+			// the read drains the ring, so its fill is only meaningful before it
+			size_t ring_bytes = 0;
+			uart_get_buffered_data_len(dev->uart, &ring_bytes);
+
+			const int rxBytes = uart_read_bytes(dev->uart, data + pending, RX_BUF_SIZE - pending, 0);
 
 			if (rxBytes > 0)
 			{
-				ESP_LOGI(TAG, "Read %d bytes", rxBytes);
-				ESP_LOG_BUFFER_HEXDUMP(TAG, data, rxBytes, ESP_LOG_INFO);
+				size_t unread = 0;
+				int64_t read_time = esp_timer_get_time();
 
-				if (rxBytesCopy >= PACKET_LEN)
-				{
-					packet_global._seq = seq;
-					seq++;
+				// frames read together arrived one after another; date each one by
+				// how many bytes came in after it, including any still in the ring
+				uart_get_buffered_data_len(dev->uart, &unread);
+
+				ESP_LOGD(TAG, "ADCS %d: read %d bytes", dev->id, rxBytes);
+				ESP_LOG_BUFFER_HEXDUMP(TAG, data + pending, rxBytes, ESP_LOG_DEBUG);
 
-					for (i = 0; i < PACKET_LEN; i++)
+				dev->stats.rx_bytes += rxBytes;
+				dev->stats.period_bytes += rxBytes;
+
+				const int len = pending + rxBytes;
+				off = 0;
+				skipped = 0;
+				while (off + PACKET_LEN <= len)
+				{
+					if (!synced)
 					{
-						packet_global._data[i] = data[i];
-						// rxBytesCopy--;
+						// wait for the next frame's status before trusting this one
+						if (off + PACKET_LEN + 2 > len)
+							break;
+						if (!frame_start_confirmed(&data[off]))
+						{
+							off++;
+							skipped++;
+							continue;
+						}
+						synced = 1;
 					}
-
-					// ESP_LOGI(TAG, "Sequence: %d", packet._seq);
-
-					// if (packet._status == STATUS_OK)
-					// 	ESP_LOGI(TAG, "Status: OK");
-					// if (packet._status == STATUS_HELLO)
-					// 	ESP_LOGI(TAG, "Status: HELLO");
-					// if (packet._status == STATUS_COMM_ERROR)
-					// 	ESP_LOGI(TAG, "Status: COMM ERROR");
-					// if (packet._status == STATUS_ADCS_ERROR)
-					// 	ESP_LOGI(TAG, "Status: SYSTEM ERROR");
-
-					// ESP_LOGI(TAG, "Voltage: %f", fixedToFloat(packet._voltage));
-					// ESP_LOGI(TAG, "Current: %d", packet._current);
-					// ESP_LOGI(TAG, "Motor speed: %d", packet._speed);
-					// ESP_LOGI(TAG, "Mag X: %d", packet._magX);
-					// ESP_LOGI(TAG, "Mag Y: %d", packet._magY);
-					// ESP_LOGI(TAG, "Mag Z: %d", packet._magZ);
-					// ESP_LOGI(TAG, "Gyro X: %f", fixedToFloat(packet._gyroX));
-					// ESP_LOGI(TAG, "Gyro Y: %f", fixedToFloat(packet._gyroY));
-					// ESP_LOGI(TAG, "Gyro Z: %f", fixedToFloat(packet._gyroZ));
-					
-
-					// packet_global = packet;
-					// num_packets++;
-
-					// if (num_packets > 10)
-					// 	num_packets = 10;
+					else if (!frame_start_valid(&data[off]))
+					{
+						synced = 0;
+						continue;
+					}
+					off += PACKET_LEN;
+					handle_frame(dev, &data[off - PACKET_LEN], seq++,
+						read_time - BYTES_TIME_US(len - off + unread));
+				}
+				if (skipped)
+				{
+					dev->flow.dropped_bytes += skipped;
+					ESP_LOGW(TAG, "ADCS %d: skipped %d bytes to find a frame start", dev->id, skipped);
 				}
+
+				pending = len - off;
+				memmove(data, &data[off], pending);
+				last_rx = start;
 			}
+			else if (start - last_rx > FRAME_TIME_US)
+			{
+				// the rest of the frame never came, the next byte starts a new one
+				dev->flow.dropped_bytes += pending;
+				pending = 0;
+				synced = 1;
+			}
+
+			update_flow(dev, ring_bytes, start);
+		}
+		else
+		{
+			pending = 0;
+			synced = 1;
 		}
 
+		int64_t now = esp_timer_get_time();
+		dev->stats.period_busy += now - start;
+		update_stats(dev, now);
+
 		vTaskDelay(10 / portTICK_RATE_MS);
 	}
 
@@ -156,4 +515,53 @@ float fixedToFloat(fixed5_3_t fix)
     float f;
     f = ((float)fix) / (1 << 3);
     return f;
+}
+
+static const char *field_names[FIELD_COUNT] = {
+	"status", "voltage", "current", "speed",
+	"magx", "magy", "magz",
+	"gyrox", "gyroy", "gyroz"
+};
+
+/**
+ * @brief
+ * Reads a single telemetry field from a packet, converting fixed-point fields
+ * to floats so every field can be handled the same way.
+ * 
+ * @param[in] packet  Packet to read
+ * @param[in] field   Field to read
+ * 
+ * @return Field value in the units reported by the REST API
+ */
+float get_field(const ADCSdata *packet, enum Field field)
+{
+	switch (field)
+	{
+		case FIELD_STATUS:  return packet->_status;
+		case FIELD_VOLTAGE: return fixedToFloat(packet->_voltage);
+		case FIELD_CURRENT: return packet->_current;
+		case FIELD_SPEED:   return packet->_speed;
+		case FIELD_MAG_X:   return packet->_magX;
+		case FIELD_MAG_Y:   return packet->_magY;
+		case FIELD_MAG_Z:   return packet->_magZ;
+		case FIELD_GYRO_X:  return fixedToFloat(packet->_gyroX);
+		case FIELD_GYRO_Y:  return fixedToFloat(packet->_gyroY);
+		case FIELD_GYRO_Z:  return fixedToFloat(packet->_gyroZ);
+		default:            return 0;
+	}
+}
+
+/**
+ * @brief
+ * Returns the JSON key used for a telemetry field.
+ * 
+ * @param[in] field  Field to name
+ * 
+ * @return Field name, or "unknown" if the field is out of range
+ */
+const char *field_name(enum Field field)
+{
+	if (field < 0 || field >= FIELD_COUNT)
+		return "unknown";
+	return field_names[field];
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
+#ifndef COMM_H
+#define COMM_H
+
 #include "driver/gpio.h"
+#include "esp_err.h"
 
 // packet sizes in bytes
 #define COMMAND_LEN 4
@@ -20,7 +24,9 @@ enum Command
 	CMD_ORIENT_X_POS= 0xe0,
 	CMD_ORIENT_Y_POS= 0xe1,
 	CMD_ORIENT_X_NEG= 0xe2,
-	CMD_ORIENT_Y_NEG= 0xe3
+	CMD_ORIENT_Y_NEG= 0xe3,
+	CMD_RATE_DOWN   = 0xd0,     // halve the telemetry reporting rate
+	CMD_RATE_UP     = 0xd1      // double the telemetry reporting rate, up to the default
 };
 
 // data packet status codes
@@ -50,7 +56,8 @@ typedef union
 
 typedef struct
 {
-	int _seq;
+	int _seq;        // starts at 1; 0 means no frame has been received
+	int64_t _time;   // esp_timer time (us) the frame finished arriving, from its place in the stream
 
 	union
 	{
@@ -75,15 +82,36 @@ typedef struct
 	};
 } ADCSdata;
 
-#define TXD_PIN (GPIO_NUM_1)
-#define RXD_PIN (GPIO_NUM_2)
+// decoded telemetry fields, for code that inspects packets field-by-field
+enum Field
+{
+	FIELD_STATUS,
+	FIELD_VOLTAGE,
+	FIELD_CURRENT,
+	FIELD_SPEED,
+	FIELD_MAG_X,
+	FIELD_MAG_Y,
+	FIELD_MAG_Z,
+	FIELD_GYRO_X,
+	FIELD_GYRO_Y,
+	FIELD_GYRO_Z,
+	FIELD_COUNT
+};
+
+// one ADCS link, defined in device.h
+typedef struct adcs_dev adcs_dev_t;
 
-void init_uart(void);
-void disable_uart(void);
-int send_command(uint8_t cmd);
+esp_err_t set_link_enabled(adcs_dev_t *dev, int enable);
+int send_command(adcs_dev_t *dev, uint8_t cmd);
 
 void rx_task(void *arg);
 
 // fixed/float conversions
 fixed5_3_t floatToFixed(float f);
-float fixedToFloat(fixed5_3_t fix);
\ No newline at end of file
+float fixedToFloat(fixed5_3_t fix);
+
+// field access, in the same units the REST API reports
+float get_field(const ADCSdata *packet, enum Field field);
+const char *field_name(enum Field field);
+
+#endif
\ No newline at end of file
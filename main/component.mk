@@ -0,0 +1,6 @@
+#
+# The continuous ADC rail source needs the IDF 4.4 adc_digi driver
+#
+ifndef CONFIG_ADCS_RAILS_SOURCE_ADC
+COMPONENT_OBJEXCLUDE := rails_adc.o
+endif
@@ -0,0 +1,199 @@
+#include "device.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "soc/soc_caps.h"
+
+static const char *TAG = "tes-dev";
+
+typedef struct
+{
+	uart_port_t uart;
+	gpio_num_t  txd_pin;
+	gpio_num_t  rxd_pin;
+	gpio_num_t  enable_pin;
+} dev_pins_t;
+
+// link wiring for each device, from menuconfig
+static const dev_pins_t dev_pins[ADCS_NUM_DEVICES] = {
+	{
+		CONFIG_ADCS_DEV0_UART,
+		CONFIG_ADCS_DEV0_TXD_PIN,
+		CONFIG_ADCS_DEV0_RXD_PIN,
+		CONFIG_ADCS_DEV0_ENABLE_PIN
+	},
+#if CONFIG_ADCS_NUM_DEVICES > 1
+	{
+		CONFIG_ADCS_DEV1_UART,
+		CONFIG_ADCS_DEV1_TXD_PIN,
+		CONFIG_ADCS_DEV1_RXD_PIN,
+		CONFIG_ADCS_DEV1_ENABLE_PIN
+	},
+#endif
+#if CONFIG_ADCS_NUM_DEVICES > 2
+	{
+		CONFIG_ADCS_DEV2_UART,
+		CONFIG_ADCS_DEV2_TXD_PIN,
+		CONFIG_ADCS_DEV2_RXD_PIN,
+		CONFIG_ADCS_DEV2_ENABLE_PIN
+	},
+#endif
+};
+
+_Static_assert(ADCS_NUM_DEVICES <= SOC_UART_NUM, "more ADCS devices than this chip has UARTs");
+_Static_assert(CONFIG_ADCS_DEV0_UART < SOC_UART_NUM, "ADCS 0 UART does not exist on this chip");
+#if CONFIG_ADCS_NUM_DEVICES > 1
+_Static_assert(CONFIG_ADCS_DEV1_UART < SOC_UART_NUM, "ADCS 1 UART does not exist on this chip");
+_Static_assert(CONFIG_ADCS_DEV1_UART != CONFIG_ADCS_DEV0_UART, "ADCS 0 and 1 share a UART");
+#endif
+#if CONFIG_ADCS_NUM_DEVICES > 2
+_Static_assert(CONFIG_ADCS_DEV2_UART < SOC_UART_NUM, "ADCS 2 UART does not exist on this chip");
+_Static_assert(CONFIG_ADCS_DEV2_UART != CONFIG_ADCS_DEV0_UART, "ADCS 0 and 2 share a UART");
+_Static_assert(CONFIG_ADCS_DEV2_UART != CONFIG_ADCS_DEV1_UART, "ADCS 1 and 2 share a UART");
+#endif
+
+static adcs_dev_t devices[ADCS_NUM_DEVICES];
+
+/**
+ * @brief
+ * Sets up every configured ADCS link: pins, command queue, rule engine, test
+ * statistics, flow control and packet history. UARTs are not installed until
+ * the link is enabled.
+ */
+void init_devices(void)
+{
+	int i;
+
+	for (i = 0; i < ADCS_NUM_DEVICES; i++)
+	{
+		adcs_dev_t *dev = &devices[i];
+
+		memset(dev, 0, sizeof(*dev));
+		dev->id = i;
+		dev->uart = dev_pins[i].uart;
+		dev->txd_pin = dev_pins[i].txd_pin;
+		dev->rxd_pin = dev_pins[i].rxd_pin;
+		dev->enable_pin = dev_pins[i].enable_pin;
+
+		if (dev->uart == UART_NUM_0)
+			ESP_LOGW(TAG, "ADCS %d uses UART 0, console output will corrupt the link", i);
+
+		portMUX_INITIALIZE(&dev->lock);
+		dev->cmd_queue = xQueueCreate(ADCS_CMD_QUEUE_LEN, sizeof(uint8_t));
+		dev->link_request = xQueueCreate(1, sizeof(int));
+		dev->link_result = xQueueCreate(1, sizeof(esp_err_t));
+		rules_init(&dev->rules);
+		test_stats_init(&dev->test);
+		resp_cache_init(&dev->data_cache);
+		flow_init(&dev->flow);
+
+		gpio_reset_pin(dev->enable_pin);
+		gpio_set_direction(dev->enable_pin, GPIO_MODE_OUTPUT);
+		gpio_set_level(dev->enable_pin, 0);
+
+		gpio_reset_pin(dev->txd_pin);
+		gpio_set_direction(dev->txd_pin, GPIO_MODE_OUTPUT);
+		gpio_set_level(dev->txd_pin, 0);
+	}
+}
+
+int num_devices(void)
+{
+	return ADCS_NUM_DEVICES;
+}
+
+adcs_dev_t *get_device(int id)
+{
+	if (id < 0 || id >= ADCS_NUM_DEVICES)
+		return NULL;
+	return &devices[id];
+}
+
+/**
+ * @brief
+ * Makes a decoded packet the device's latest packet and appends it to the
+ * history. The packet's sequence number and timestamp must already be set.
+ *
+ * @param[in,out] dev     Device that received the packet
+ * @param[in]     packet  Decoded packet
+ */
+void device_publish(adcs_dev_t *dev, const ADCSdata *packet)
+{
+	portENTER_CRITICAL(&dev->lock);
+	dev->packet = *packet;
+	dev->history[dev->history_count % ADCS_HISTORY_LEN] = *packet;
+	dev->history_count++;
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+void device_get_packet(adcs_dev_t *dev, ADCSdata *out)
+{
+	portENTER_CRITICAL(&dev->lock);
+	*out = dev->packet;
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+/**
+ * @brief
+ * Copies packets with a sequence number greater than `since` out of the
+ * history, oldest first. Packets that have already been overwritten, or were
+ * withheld by flow control, are not returned.
+ *
+ * @param[in]  dev    Device to read
+ * @param[in]  since  Last sequence number the caller has seen (-1 for everything)
+ * @param[out] out    Destination array
+ * @param[in]  max    Size of the destination array
+ *
+ * @return Number of packets copied
+ */
+int device_get_history(adcs_dev_t *dev, int since, ADCSdata *out, int max)
+{
+	int n = 0;
+	int i;
+
+	portENTER_CRITICAL(&dev->lock);
+	i = dev->history_count - ADCS_HISTORY_LEN;
+	if (i < 0)
+		i = 0;
+	for (; i < dev->history_count && n < max; i++)
+	{
+		const ADCSdata *packet = &dev->history[i % ADCS_HISTORY_LEN];
+		if (packet->_seq > since)
+			out[n++] = *packet;
+	}
+	portEXIT_CRITICAL(&dev->lock);
+
+	return n;
+}
+
+void device_get_stats(adcs_dev_t *dev, adcs_stats_t *out)
+{
+	portENTER_CRITICAL(&dev->lock);
+	*out = dev->stats;
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+void device_get_flow(adcs_dev_t *dev, flow_ctl_t *out)
+{
+	portENTER_CRITICAL(&dev->lock);
+	*out = dev->flow;
+	portEXIT_CRITICAL(&dev->lock);
+}
+
+/**
+ * @brief
+ * Records one telemetry response sent to a client. A send blocks once the
+ * socket buffer is full, so the time spent sending grows with the number of
+ * clients and with Wi-Fi congestion; flow control uses it as its client load.
+ *
+ * @param[in,out] dev      Device whose telemetry was sent
+ * @param[in]     send_us  Time the send took (us)
+ */
+void device_note_client_send(adcs_dev_t *dev, int64_t send_us)
+{
+	portENTER_CRITICAL(&dev->lock);
+	dev->stats.client_requests++;
+	dev->stats.period_requests++;
+	dev->stats.period_send += send_us;
+	portEXIT_CRITICAL(&dev->lock);
+}
@@ -0,0 +1,93 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "comm.h"
+#include "rules.h"
+#include "teststats.h"
+#include "respcache.h"
+#include "flowctl.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "sdkconfig.h"
+
+#define ADCS_NUM_DEVICES    CONFIG_ADCS_NUM_DEVICES
+// packets kept per device for /api/adcs/{id}/history
+#define ADCS_HISTORY_LEN    32
+// commands that may wait for the receive task to put them on the wire
+#define ADCS_CMD_QUEUE_LEN  8
+// websocket pushes that may be queued for clients before new ones are dropped
+#define ADCS_CLIENT_BACKLOG_MAX 8
+// how long a REST handler waits for the receive task to enable or disable a link
+#define ADCS_LINK_TIMEOUT_MS 1000
+// how often link throughput and CPU usage are recomputed
+#define ADCS_STATS_PERIOD_US 1000000
+
+// link statistics, rates are taken over the last ADCS_STATS_PERIOD_US
+typedef struct
+{
+	uint32_t rx_bytes;
+	uint32_t rx_frames;
+	uint32_t tx_commands;
+
+	uint32_t rx_bytes_per_sec;
+	uint32_t rx_frames_per_sec;
+	uint32_t cpu_permille;      // share of one core spent in the receive task
+
+	// telemetry responses (/data, /history) sent to clients
+	uint32_t client_requests;
+	uint32_t client_requests_per_sec;
+	uint32_t client_send_permille;   // share of time the HTTP server spent sending them
+
+	// bookkeeping for the current period
+	int64_t  period_start;
+	int64_t  period_busy;
+	uint32_t period_bytes;
+	uint32_t period_frames;
+	int64_t  period_send;
+	uint32_t period_requests;
+} adcs_stats_t;
+
+struct adcs_dev
+{
+	int           id;
+	uart_port_t   uart;
+	gpio_num_t    txd_pin;
+	gpio_num_t    rxd_pin;
+	gpio_num_t    enable_pin;
+
+	volatile int  enabled;          // written only by the receive task
+	TaskHandle_t  task;
+	QueueHandle_t cmd_queue;
+	QueueHandle_t link_request;     // enable/disable requests for the receive task
+	QueueHandle_t link_result;      // esp_err_t answer to the last request
+	QueueHandle_t uart_queue;       // UART driver events, for overflow detection
+	volatile int  client_backlog;   // pushes queued for clients, maintained by the REST server
+
+	// latest packet and recent history, guarded by lock
+	portMUX_TYPE  lock;
+	ADCSdata      packet;
+	ADCSdata      history[ADCS_HISTORY_LEN];
+	int           history_count;   // packets ever published; sequence numbers may skip
+
+	rule_engine_t rules;
+	test_stats_t  test;
+	resp_cache_t  data_cache;   // encoded /data responses, owned by the REST server
+	adcs_stats_t  stats;
+	flow_ctl_t    flow;
+};
+
+void init_devices(void);
+int num_devices(void);
+adcs_dev_t *get_device(int id);
+
+void device_publish(adcs_dev_t *dev, const ADCSdata *packet);
+void device_get_packet(adcs_dev_t *dev, ADCSdata *out);
+int device_get_history(adcs_dev_t *dev, int since, ADCSdata *out, int max);
+void device_get_stats(adcs_dev_t *dev, adcs_stats_t *out);
+void device_get_flow(adcs_dev_t *dev, flow_ctl_t *out);
+void device_note_client_send(adcs_dev_t *dev, int64_t send_us);
+
+#endif
@@ -8,6 +8,9 @@
 */
 
 #include "comm.h"
+#include "device.h"
+#include "rails.h"
+#include "assetpack.h"
 
 #include "sdkconfig.h"
 #include "driver/gpio.h"
@@ -26,7 +29,6 @@
 #include "driver/sdmmc_host.h"
 #endif
 
-#define GPIO_ENABLE 0
 #define MDNS_HOST_NAME "adcs-test-rig"
 
 #define MDNS_INSTANCE "esp home web server"
@@ -35,7 +37,6 @@ static const char *TAG = "tes";
 
 esp_err_t start_rest_server(const char *base_path);
 
-extern ADCSdata packet_global;
 
 static void initialise_mdns(void)
 {
@@ -131,27 +132,39 @@ esp_err_t init_fs(void)
 }
 #endif
 
+#if CONFIG_EXAMPLE_WEB_DEPLOY_PACK
+esp_err_t init_fs(void)
+{
+    esp_err_t ret = asset_pack_init("www");
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map web asset pack (%s)", esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+#endif
+
 void app_main(void)
 {
-	gpio_reset_pin(GPIO_ENABLE);
-	gpio_set_direction(GPIO_ENABLE, GPIO_MODE_OUTPUT);
-	gpio_set_level(GPIO_ENABLE, 0);
+	char name[configMAX_TASK_NAME_LEN];
+	int i;
 
-	gpio_reset_pin(TXD_PIN);
-	gpio_set_direction(TXD_PIN, GPIO_MODE_OUTPUT);
-	gpio_set_level(TXD_PIN, 0);
+	init_devices();
 
-	int i;
-	for (i = 0; i < PACKET_LEN; i++)
+	for (i = 0; i < num_devices(); i++)
 	{
-		packet_global._data[i] = 0;
+		snprintf(name, sizeof(name), "uart_rx_task%d", i);
+		xTaskCreate(rx_task, name, 1024*4, get_device(i), configMAX_PRIORITIES, NULL);
 	}
-	packet_global._seq = 0;
-
-	xTaskCreate(rx_task, "uart_rx_task", 1024*2, NULL, configMAX_PRIORITIES, NULL);
 
 	// init_uart();
 
+#if CONFIG_ADCS_RAILS_SOURCE_ADC
+	start_rails(&rail_source_adc);
+#else
+	start_rails(&rail_source_synth);
+#endif
+
     ESP_ERROR_CHECK(nvs_flash_init());
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -0,0 +1,140 @@
+#include "flowctl.h"
+#include "comm.h"
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "tes-flow";
+
+#define HOLD_US ((int64_t)CONFIG_ADCS_FLOW_HOLD_MS * 1000)
+
+void flow_init(flow_ctl_t *fc)
+{
+	memset(fc, 0, sizeof(*fc));
+}
+
+/**
+ * @brief
+ * Forgets the control state of a link that went down, keeping the counters.
+ * A re-enabled ADCS starts over at its default rate, so neither the level nor
+ * the base rate learned before still applies.
+ *
+ * @param[in,out] fc   Flow controller of the link
+ * @param[in]     now  esp_timer time (us)
+ */
+void flow_reset(flow_ctl_t *fc, int64_t now)
+{
+	fc->level = 0;
+	fc->pressure = 0;
+	fc->ring_fill = 0;
+	fc->base_rate = 0;
+	fc->since = now;
+	fc->last_change = now;
+	fc->budget = 0;
+	fc->budget_time = now;
+}
+
+/**
+ * @brief
+ * Feeds the current load figures into the flow controller. The level only
+ * moves after pressure has stayed past a water mark for the hold time, and at
+ * most once per hold time, so the ADCS is not flooded with rate changes.
+ *
+ * @param[in,out] fc              Flow controller of the link
+ * @param[in]     ring_fill       UART ring fill, percent
+ * @param[in]     client_load     Client load, percent
+ * @param[in]     cpu             Receive task CPU share, percent
+ * @param[in]     frame_rate      Frames received per second
+ * @param[in]     now             esp_timer time (us)
+ *
+ * @return CMD_RATE_DOWN or CMD_RATE_UP to send to the ADCS, or -1 for none
+ */
+int flow_update(flow_ctl_t *fc, int ring_fill, int client_load, int cpu, uint32_t frame_rate, int64_t now)
+{
+	int pressure = ring_fill;
+	int old = fc->pressure;
+
+	if (client_load > pressure)
+		pressure = client_load;
+	if (cpu > pressure)
+		pressure = cpu;
+
+	fc->ring_fill = ring_fill;
+	fc->pressure = pressure;
+
+	// the publish cap is derived from the unthrottled rate,
+	// so it is only learned at level 0
+	if (fc->level == 0)
+		fc->base_rate = frame_rate;
+
+	// restart the hold timer whenever pressure moves between bands
+	if ((pressure >= CONFIG_ADCS_FLOW_HIGH_WATER) != (old >= CONFIG_ADCS_FLOW_HIGH_WATER) ||
+		(pressure <= CONFIG_ADCS_FLOW_LOW_WATER) != (old <= CONFIG_ADCS_FLOW_LOW_WATER))
+	{
+		fc->since = now;
+	}
+
+	if (now - fc->since < HOLD_US || now - fc->last_change < HOLD_US)
+		return -1;
+
+	if (pressure >= CONFIG_ADCS_FLOW_HIGH_WATER && fc->level < CONFIG_ADCS_FLOW_MAX_LEVEL)
+	{
+		fc->level++;
+		fc->last_change = now;
+		fc->rate_down++;
+		ESP_LOGW(TAG, "Pressure %d%%, asking for 1/%d of %u frames/s", pressure, 1 << fc->level, (unsigned)fc->base_rate);
+		return CMD_RATE_DOWN;
+	}
+
+	if (pressure <= CONFIG_ADCS_FLOW_LOW_WATER && fc->level > 0)
+	{
+		fc->level--;
+		fc->last_change = now;
+		fc->rate_up++;
+		ESP_LOGI(TAG, "Pressure %d%%, asking for 1/%d of %u frames/s", pressure, 1 << fc->level, (unsigned)fc->base_rate);
+		return CMD_RATE_UP;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief
+ * Decides whether a decoded frame is passed on to clients. At level n at most
+ * base_rate / 2^n frames per second are published, the rate the ADCS was
+ * asked for. Once the ADCS has slowed down every frame fits the budget, so
+ * nothing is withheld; the cap only bridges the time until it does. Up to two
+ * frame periods of budget are kept so arrival jitter doesn't cost frames.
+ *
+ * @param[in,out] fc    Flow controller of the link
+ * @param[in]     time  When the frame arrived (us)
+ *
+ * @return true if the frame should be published
+ */
+bool flow_should_publish(flow_ctl_t *fc, int64_t time)
+{
+	int64_t period;
+
+	if (fc->level == 0 || fc->base_rate == 0)
+	{
+		fc->budget_time = time;
+		return true;
+	}
+
+	period = ((int64_t)1000000 << fc->level) / fc->base_rate;
+
+	fc->budget += time - fc->budget_time;
+	fc->budget_time = time;
+	if (fc->budget > 2 * period)
+		fc->budget = 2 * period;
+
+	if (fc->budget >= period)
+	{
+		fc->budget -= period;
+		return true;
+	}
+
+	fc->decimated++;
+	return false;
+}
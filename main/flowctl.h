@@ -0,0 +1,45 @@
+#ifndef FLOWCTL_H
+#define FLOWCTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Flow control for one ADCS link. Pressure is the worst of the UART ring
+ * fill, the client load and the receive task's CPU share, in percent. Client
+ * load is the websocket push backlog or the share of time the HTTP server
+ * spends sending this link's telemetry, whichever is higher; the latter grows
+ * with the number of clients and with Wi-Fi congestion.
+ * Sustained pressure above the high water mark raises the level by one and
+ * asks the ADCS to halve its rate; sustained pressure below the low water mark
+ * undoes one level. Publishing to clients is capped at the rate the current
+ * level asked for, so frames are only withheld while the ADCS still sends
+ * faster than that, i.e. until it acts on the command.
+ */
+typedef struct
+{
+	int      level;          // the ADCS was asked for 1/2^level of its base rate
+	int      pressure;       // last pressure, percent
+	int      ring_fill;      // last UART ring fill, percent
+	uint32_t base_rate;      // frames/s measured at level 0
+	int64_t  since;          // when pressure last crossed a water mark
+	int64_t  last_change;    // when the level last changed
+
+	// publish budget in microseconds of frame time, refilled as time passes
+	int64_t  budget;
+	int64_t  budget_time;
+
+	uint32_t decimated;      // frames decoded but withheld from clients
+	uint32_t dropped_bytes;  // bytes lost before decoding
+	uint32_t overflows;      // UART FIFO or ring overflow events
+	uint32_t client_drops;   // pushes not queued because clients were behind
+	uint32_t rate_down;      // CMD_RATE_DOWN sent
+	uint32_t rate_up;        // CMD_RATE_UP sent
+} flow_ctl_t;
+
+void flow_init(flow_ctl_t *fc);
+void flow_reset(flow_ctl_t *fc, int64_t now);
+int flow_update(flow_ctl_t *fc, int ring_fill, int client_load, int cpu, uint32_t frame_rate, int64_t now);
+bool flow_should_publish(flow_ctl_t *fc, int64_t time);
+
+#endif
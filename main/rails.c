@@ -0,0 +1,188 @@
+#include "rails.h"
+
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "tes-rails";
+
+// samples fetched from the source per read
+#define READ_BLOCK 256
+// samples averaged into one decimated point, over all rails
+#define BLOCK_LEN  (CONFIG_ADCS_RAILS_DECIMATION * RAIL_COUNT)
+
+static const char *rail_names[RAIL_COUNT] = { "supply", "current" };
+
+// scale from millivolts at the ADC pin to rail units
+static const float rail_scale[RAIL_COUNT] = {
+	CONFIG_ADCS_RAILS_SUPPLY_DIVIDER / 1000.0f,
+	1000.0f / CONFIG_ADCS_RAILS_CURRENT_MV_PER_A
+};
+
+static const rail_source_t *rail_source;
+
+// decimated points, guarded by rails_lock
+static rail_point_t history[RAILS_HISTORY_LEN];
+static uint32_t next_point;
+static SemaphoreHandle_t rails_lock;
+
+static void publish(const rail_point_t *point)
+{
+	xSemaphoreTake(rails_lock, portMAX_DELAY);
+	history[next_point % RAILS_HISTORY_LEN] = *point;
+	next_point++;
+	xSemaphoreGive(rails_lock);
+}
+
+/**
+ * @brief
+ * Pulls samples from the rail source and decimates them by averaging each
+ * block of CONFIG_ADCS_RAILS_DECIMATION samples per rail. Samples are dated
+ * backwards from the time the read returned, using the nominal sample period,
+ * so points share esp_timer's clock with decoded UART frames. Samples that sat
+ * buffered in the source before the read are dated too late by that long; for
+ * the ADC source that is up to its whole DMA pool, 512 samples or about 25 ms
+ * at the default 20 kHz on the esp32s2.
+ */
+static void rails_task(void *arg)
+{
+	rail_sample_t *samples = malloc(READ_BLOCK * sizeof(rail_sample_t));
+	const float period_us = 1e6f / CONFIG_ADCS_RAILS_SAMPLE_RATE;
+	uint32_t sum[RAIL_COUNT] = { 0 };
+	uint32_t count[RAIL_COUNT] = { 0 };
+	int block = 0;
+	int64_t block_start = 0;
+	int i, r;
+
+	while (1)
+	{
+		int n = rail_source->read(samples, READ_BLOCK, 100);
+		int64_t end = esp_timer_get_time();
+
+		for (i = 0; i < n; i++)
+		{
+			int64_t t = end - (int64_t)((n - 1 - i) * period_us);
+			uint8_t rail = samples[i].rail;
+
+			if (block == 0)
+				block_start = t;
+			if (rail < RAIL_COUNT)
+			{
+				sum[rail] += samples[i].raw;
+				count[rail]++;
+			}
+
+			if (++block < BLOCK_LEN)
+				continue;
+
+			rail_point_t point;
+			point.time = (block_start + t) / 2;
+			for (r = 0; r < RAIL_COUNT; r++)
+			{
+				point.value[r] = count[r] ?
+					rail_source->to_mv((float)sum[r] / count[r]) * rail_scale[r] : 0;
+				sum[r] = 0;
+				count[r] = 0;
+			}
+			publish(&point);
+			block = 0;
+		}
+	}
+
+	free(samples);
+}
+
+/**
+ * @brief
+ * Starts continuous sampling of the rig's supply rails from the given source
+ * and the background task that decimates them.
+ *
+ * @param[in] source  Sample source, e.g. &rail_source_adc
+ *
+ * @return ESP_OK on success, or the source's error
+ */
+esp_err_t start_rails(const rail_source_t *source)
+{
+	rails_lock = xSemaphoreCreateMutex();
+	if (!rails_lock)
+		return ESP_ERR_NO_MEM;
+
+	esp_err_t ret = source->start(CONFIG_ADCS_RAILS_SAMPLE_RATE);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Failed to start %s rail source (%s)", source->name, esp_err_to_name(ret));
+		return ret;
+	}
+
+	rail_source = source;
+	if (xTaskCreate(rails_task, "rails_task", 1024*4, NULL, 5, NULL) != pdPASS)
+	{
+		source->stop();
+		rail_source = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(TAG, "Sampling rails from %s at %d Hz", source->name, CONFIG_ADCS_RAILS_SAMPLE_RATE);
+	return ESP_OK;
+}
+
+int rails_get_latest(rail_point_t *out)
+{
+	int found = 0;
+
+	if (!rail_source)
+		return 0;
+
+	xSemaphoreTake(rails_lock, portMAX_DELAY);
+	if (next_point > 0)
+	{
+		*out = history[(next_point - 1) % RAILS_HISTORY_LEN];
+		found = 1;
+	}
+	xSemaphoreGive(rails_lock);
+
+	return found;
+}
+
+/**
+ * @brief
+ * Copies decimated points newer than `since` out of the history, oldest
+ * first.
+ *
+ * @param[in]  since  Timestamp (us) of the last point the caller has seen
+ * @param[out] out    Destination array
+ * @param[in]  max    Size of the destination array
+ *
+ * @return Number of points copied
+ */
+int rails_get_history(int64_t since, rail_point_t *out, int max)
+{
+	int n = 0;
+	uint32_t i;
+
+	if (!rail_source)
+		return 0;
+
+	xSemaphoreTake(rails_lock, portMAX_DELAY);
+	i = next_point > RAILS_HISTORY_LEN ? next_point - RAILS_HISTORY_LEN : 0;
+	for (; i < next_point && n < max; i++)
+	{
+		const rail_point_t *point = &history[i % RAILS_HISTORY_LEN];
+		if (point->time > since)
+			out[n++] = *point;
+	}
+	xSemaphoreGive(rails_lock);
+
+	return n;
+}
+
+const char *rail_name(enum Rail rail)
+{
+	if (rail < 0 || rail >= RAIL_COUNT)
+		return "unknown";
+	return rail_names[rail];
+}
@@ -0,0 +1,56 @@
+#ifndef RAILS_H
+#define RAILS_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// rig supply rails that are sampled, in ADC pattern order
+enum Rail
+{
+	RAIL_SUPPLY,    // supply voltage (mV)
+	RAIL_CURRENT,   // supply current (mA)
+	RAIL_COUNT
+};
+
+// decimated points kept for /api/v1/rails
+#define RAILS_HISTORY_LEN 256
+
+typedef struct
+{
+	uint8_t  rail;   // enum Rail
+	uint16_t raw;    // raw ADC code
+} rail_sample_t;
+
+/*
+ * Where rail samples come from. The continuous ADC is one implementation; a
+ * synthetic source stands in for it where there is no ADC hardware.
+ */
+typedef struct
+{
+	const char *name;
+
+	// start sampling every rail at sample_rate samples per second in total
+	esp_err_t (*start)(uint32_t sample_rate);
+	// wait up to timeout_ms for samples, returning how many were copied to out
+	int (*read)(rail_sample_t *out, int max, uint32_t timeout_ms);
+	// convert a (possibly averaged) raw code to millivolts at the ADC pin
+	float (*to_mv)(float raw);
+	void (*stop)(void);
+} rail_source_t;
+
+extern const rail_source_t rail_source_adc;
+extern const rail_source_t rail_source_synth;
+
+// one decimated point, timestamped on the same clock as ADCSdata._time
+typedef struct
+{
+	int64_t time;
+	float   value[RAIL_COUNT];
+} rail_point_t;
+
+esp_err_t start_rails(const rail_source_t *source);
+int rails_get_latest(rail_point_t *out);
+int rails_get_history(int64_t since, rail_point_t *out, int max);
+const char *rail_name(enum Rail rail);
+
+#endif
@@ -0,0 +1,166 @@
+#include "rails.h"
+
+#include "sdkconfig.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0)
+#error "The ADC rail source needs the ESP-IDF 4.4 adc_digi driver, select ADCS_RAILS_SOURCE_SYNTH"
+#endif
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+
+static const char *TAG = "tes-rails-adc";
+
+// bytes the DMA hands over per conversion frame
+#define ADC_FRAME_LEN 256
+// frames the driver's pool holds before it drops samples
+#define ADC_POOL_FRAMES 4
+
+#if CONFIG_IDF_TARGET_ESP32
+// the ESP32 DMA controller only works with the conversion limit enabled
+#define ADC_CONV_LIMIT_EN true
+#define ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_RESULT_CHANNEL(p) ((p)->type1.channel)
+#define ADC_RESULT_DATA(p)    ((p)->type1.data)
+#else
+#define ADC_CONV_LIMIT_EN false
+#define ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_RESULT_CHANNEL(p) ((p)->type2.channel)
+#define ADC_RESULT_DATA(p)    ((p)->type2.data)
+#endif
+
+// width of the DMA result field, and the width esp_adc_cal characterises
+// (only the chip's default width is supported there)
+#if CONFIG_IDF_TARGET_ESP32S2
+#define ADC_RESULT_BITS 11   // type2.data holds the top 11 bits of the conversion
+#define ADC_CAL_BITS    13
+#else
+#define ADC_RESULT_BITS 12
+#define ADC_CAL_BITS    12
+#endif
+#define ADC_CAL_WIDTH   ADC_WIDTH_BIT_DEFAULT
+
+// Vref for chips without eFuse calibration, the nominal value from the datasheet
+#define ADC_DEFAULT_VREF 1100
+
+// ADC1 channel wired to each rail, in enum Rail order
+static const uint8_t rail_channels[RAIL_COUNT] = {
+	CONFIG_ADCS_RAILS_SUPPLY_CHANNEL,
+	CONFIG_ADCS_RAILS_CURRENT_CHANNEL
+};
+
+static esp_adc_cal_characteristics_t adc_chars;
+static uint8_t frame[ADC_FRAME_LEN];
+
+static esp_err_t adc_start(uint32_t sample_rate)
+{
+	adc_digi_pattern_config_t pattern[RAIL_COUNT] = { 0 };
+	uint32_t mask = 0;
+	esp_err_t ret;
+	int i;
+
+	for (i = 0; i < RAIL_COUNT; i++)
+	{
+		mask |= BIT(rail_channels[i]);
+		pattern[i].atten = ADC_ATTEN_DB_11;
+		pattern[i].channel = rail_channels[i];
+		pattern[i].unit = 0;
+		pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+	}
+
+	adc_digi_init_config_t init_config = {
+		.max_store_buf_size = ADC_FRAME_LEN * ADC_POOL_FRAMES,
+		.conv_num_each_intr = ADC_FRAME_LEN,
+		.adc1_chan_mask = mask,
+		.adc2_chan_mask = 0,
+	};
+	ret = adc_digi_initialize(&init_config);
+	if (ret != ESP_OK)
+		return ret;
+
+	adc_digi_configuration_t dig_cfg = {
+		.conv_limit_en = ADC_CONV_LIMIT_EN,
+		.conv_limit_num = 250,
+		.pattern_num = RAIL_COUNT,
+		.adc_pattern = pattern,
+		.sample_freq_hz = sample_rate,
+		.conv_mode = ADC_CONV_SINGLE_UNIT_1,
+		.format = ADC_OUTPUT_TYPE,
+	};
+	ret = adc_digi_controller_configure(&dig_cfg);
+	if (ret != ESP_OK)
+	{
+		adc_digi_deinitialize();
+		return ret;
+	}
+
+	esp_adc_cal_value_t cal = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_CAL_WIDTH,
+		ADC_DEFAULT_VREF, &adc_chars);
+	if (cal == ESP_ADC_CAL_VAL_DEFAULT_VREF)
+		ESP_LOGW(TAG, "No ADC calibration in eFuse, assuming Vref = %d mV", ADC_DEFAULT_VREF);
+
+	return adc_digi_start();
+}
+
+static int adc_read(rail_sample_t *out, int max, uint32_t timeout_ms)
+{
+	uint32_t len = max * SOC_ADC_DIGI_RESULT_BYTES;
+	uint32_t got = 0;
+	uint32_t i;
+	int n = 0;
+	int r;
+
+	if (len > sizeof(frame))
+		len = sizeof(frame);
+
+	esp_err_t ret = adc_digi_read_bytes(frame, len, &got, timeout_ms);
+	if (ret == ESP_ERR_INVALID_STATE)
+	{
+		// the driver's pool overflowed and dropped samples, keep what is left
+		ESP_LOGW(TAG, "ADC pool overflow, samples lost");
+	}
+	else if (ret != ESP_OK)
+	{
+		return 0;
+	}
+
+	for (i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= got; i += SOC_ADC_DIGI_RESULT_BYTES)
+	{
+		adc_digi_output_data_t *p = (adc_digi_output_data_t *)&frame[i];
+
+		for (r = 0; r < RAIL_COUNT; r++)
+		{
+			if (ADC_RESULT_CHANNEL(p) == rail_channels[r])
+				break;
+		}
+
+		out[n].rail = r;   // RAIL_COUNT marks a sample from no known rail
+		out[n].raw = ADC_RESULT_DATA(p);
+		n++;
+	}
+
+	return n;
+}
+
+// raw is an average of DMA results, so it is scaled up to the calibration
+// width before rounding to keep the fraction the averaging gained
+static float adc_to_mv(float raw)
+{
+	return esp_adc_cal_raw_to_voltage((uint32_t)(raw * (1 << (ADC_CAL_BITS - ADC_RESULT_BITS)) + 0.5f), &adc_chars);
+}
+
+static void adc_stop(void)
+{
+	adc_digi_stop();
+	adc_digi_deinitialize();
+}
+
+// continuous ADC1 sampling via DMA (IDF 4.4 adc_digi driver)
+const rail_source_t rail_source_adc = {
+	.name = "adc",
+	.start = adc_start,
+	.read = adc_read,
+	.to_mv = adc_to_mv,
+	.stop = adc_stop
+};
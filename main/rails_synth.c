@@ -0,0 +1,58 @@
+#include "rails.h"
+#include "rails_synth.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+/*
+ * Synthetic rail source: hands out the signal from rails_synth_signal.c,
+ * paced by esp_timer so downstream code sees the configured sample rate.
+ */
+
+static synth_signal_t synth;
+static int64_t synth_start;
+
+static esp_err_t synth_start_sampling(uint32_t sample_rate)
+{
+	if (sample_rate == 0)
+		return ESP_ERR_INVALID_ARG;
+
+	synth_signal_init(&synth, sample_rate);
+	synth_start = esp_timer_get_time();
+	return ESP_OK;
+}
+
+static int synth_read(rail_sample_t *out, int max, uint32_t timeout_ms)
+{
+	int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+	int64_t due;
+
+	while ((due = (esp_timer_get_time() - synth_start) * synth.rate / 1000000 - (int64_t)synth.produced) <= 0)
+	{
+		if (esp_timer_get_time() >= deadline)
+			return 0;
+		vTaskDelay(1);
+	}
+
+	return synth_signal_generate(&synth, out, due < max ? (int)due : max);
+}
+
+// synthetic codes are already millivolts
+static float synth_to_mv(float raw)
+{
+	return raw;
+}
+
+static void synth_stop(void)
+{
+	synth.rate = 0;
+}
+
+const rail_source_t rail_source_synth = {
+	.name = "synthetic",
+	.start = synth_start_sampling,
+	.read = synth_read,
+	.to_mv = synth_to_mv,
+	.stop = synth_stop
+};
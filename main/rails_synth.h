@@ -0,0 +1,24 @@
+#ifndef RAILS_SYNTH_H
+#define RAILS_SYNTH_H
+
+#include <stdint.h>
+#include "rails.h"
+
+/*
+ * Synthetic rail signal: a supply sitting around 3.3 V behind a 2:1 divider
+ * with 50 Hz ripple, and a current sense output, both stepping every two
+ * seconds as if a motor load switched on and off. Codes are millivolts at the
+ * ADC pin. The generator only does arithmetic, so it runs the same on the
+ * host as on the chip; pacing to real time is left to rail_source_synth.
+ */
+typedef struct
+{
+	uint32_t rate;       // samples per second, over all rails
+	uint64_t produced;   // samples generated so far
+	uint32_t noise;      // LCG state
+} synth_signal_t;
+
+void synth_signal_init(synth_signal_t *sig, uint32_t sample_rate);
+int synth_signal_generate(synth_signal_t *sig, rail_sample_t *out, int n);
+
+#endif
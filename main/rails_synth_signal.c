@@ -0,0 +1,57 @@
+#include "rails_synth.h"
+
+#include <math.h>
+#include <string.h>
+
+#define SYNTH_RIPPLE_HZ 50.0f
+#define SYNTH_LOAD_S    2
+
+// small LCG, keeps the signal free of any hardware RNG and repeatable
+static int noise(synth_signal_t *sig, int amplitude)
+{
+	sig->noise = sig->noise * 1103515245u + 12345u;
+	return (int)((sig->noise >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static rail_sample_t synth_sample(synth_signal_t *sig, uint64_t k)
+{
+	rail_sample_t sample;
+	float t = (float)(k / RAIL_COUNT) * RAIL_COUNT / sig->rate;
+	int load = ((int)t / SYNTH_LOAD_S) % 2;
+	float mv;
+
+	sample.rail = k % RAIL_COUNT;
+	if (sample.rail == RAIL_SUPPLY)
+		mv = 1650.0f + 15.0f * sinf(2.0f * (float)M_PI * SYNTH_RIPPLE_HZ * t) - 60.0f * load;
+	else
+		mv = 120.0f + 450.0f * load;
+	sample.raw = (uint16_t)(mv + noise(sig, 4));
+	return sample;
+}
+
+void synth_signal_init(synth_signal_t *sig, uint32_t sample_rate)
+{
+	memset(sig, 0, sizeof(*sig));
+	sig->rate = sample_rate;
+	sig->noise = 1;
+}
+
+/**
+ * @brief
+ * Produces the next samples of the signal, rails interleaved in enum Rail
+ * order, as if sampled at the configured rate.
+ *
+ * @param[in,out] sig  Signal state
+ * @param[out]    out  Destination array
+ * @param[in]     n    Number of samples to produce
+ *
+ * @return Number of samples written, n
+ */
+int synth_signal_generate(synth_signal_t *sig, rail_sample_t *out, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = synth_sample(sig, sig->produced++);
+	return n;
+}
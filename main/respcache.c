@@ -0,0 +1,122 @@
+#include "respcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void resp_free(cached_resp_t *resp)
+{
+	free(resp->json);
+	free(resp);
+}
+
+static cached_resp_t *resp_build(const ADCSdata *packet, resp_encode_fn encode)
+{
+	cached_resp_t *resp = calloc(1, sizeof(cached_resp_t));
+	int32_t seq = packet->_seq;
+	int64_t time = packet->_time;
+
+	if (!resp)
+		return NULL;
+
+	resp->json = encode(packet);
+	if (!resp->json)
+	{
+		free(resp);
+		return NULL;
+	}
+	resp->json_len = strlen(resp->json);
+	resp->seq = packet->_seq;
+
+	// the ESP32 is little endian, so the fields can be copied as they are
+	memcpy(&resp->bin[0], &seq, sizeof(seq));
+	memcpy(&resp->bin[4], &time, sizeof(time));
+	memcpy(&resp->bin[12], packet->_data, PACKET_LEN);
+
+	return resp;
+}
+
+void resp_cache_init(resp_cache_t *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	portMUX_INITIALIZE(&cache->lock);
+}
+
+/**
+ * @brief
+ * Returns the encoded form of a packet, encoding it only if no request has
+ * asked for this sequence number yet. Encoding happens outside the lock, so
+ * concurrent requests never wait on each other's cJSON work; if two race to
+ * encode the same packet, the loser's copy is thrown away. The returned entry
+ * stays valid until it is handed back to resp_cache_release(), even if a newer
+ * packet replaces it in the cache meanwhile. Entries are keyed on the sequence
+ * number alone, so the seq 0 placeholder of a device without data must not be
+ * passed in.
+ *
+ * @param[in,out] cache   Cache of the device the packet came from
+ * @param[in]     packet  Packet to serve
+ * @param[in]     encode  JSON encoder, used on a cache miss
+ *
+ * @return Referenced entry, or NULL if out of memory
+ */
+cached_resp_t *resp_cache_acquire(resp_cache_t *cache, const ADCSdata *packet, resp_encode_fn encode)
+{
+	cached_resp_t *resp;
+	cached_resp_t *stale = NULL;
+
+	portENTER_CRITICAL(&cache->lock);
+	resp = cache->current;
+	if (resp && resp->seq == packet->_seq)
+	{
+		resp->refs++;
+		cache->hits++;
+		portEXIT_CRITICAL(&cache->lock);
+		return resp;
+	}
+	portEXIT_CRITICAL(&cache->lock);
+
+	cached_resp_t *fresh = resp_build(packet, encode);
+	if (!fresh)
+		return NULL;
+
+	portENTER_CRITICAL(&cache->lock);
+	cache->builds++;
+	resp = cache->current;
+	if (resp && resp->seq == fresh->seq)
+	{
+		// another request encoded the same packet first
+		resp->refs++;
+		stale = fresh;
+	}
+	else if (!resp || resp->seq < fresh->seq)
+	{
+		// one reference for the cache, one for the caller
+		fresh->refs = 2;
+		cache->current = fresh;
+		if (resp && --resp->refs == 0)
+			stale = resp;
+		resp = fresh;
+	}
+	else
+	{
+		// the cache already holds a newer packet, don't roll it back
+		fresh->refs = 1;
+		resp = fresh;
+	}
+	portEXIT_CRITICAL(&cache->lock);
+
+	if (stale)
+		resp_free(stale);
+	return resp;
+}
+
+void resp_cache_release(resp_cache_t *cache, cached_resp_t *resp)
+{
+	int refs;
+
+	portENTER_CRITICAL(&cache->lock);
+	refs = --resp->refs;
+	portEXIT_CRITICAL(&cache->lock);
+
+	if (refs == 0)
+		resp_free(resp);
+}
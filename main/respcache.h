@@ -0,0 +1,37 @@
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+
+#include "comm.h"
+
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+
+// binary form: seq (int32), time (int64), then the raw packet bytes, little endian
+#define RESP_BIN_LEN (4 + 8 + PACKET_LEN)
+
+// one packet, encoded once and shared by every request that wants it
+typedef struct
+{
+	int     seq;
+	int     refs;
+	char   *json;
+	size_t  json_len;
+	uint8_t bin[RESP_BIN_LEN];
+} cached_resp_t;
+
+typedef struct
+{
+	cached_resp_t *current;
+	portMUX_TYPE   lock;
+	uint32_t       builds;   // times a packet was encoded
+	uint32_t       hits;     // requests served from an existing encoding
+} resp_cache_t;
+
+// encodes a packet as JSON into a malloc'd string
+typedef char *(*resp_encode_fn)(const ADCSdata *packet);
+
+void resp_cache_init(resp_cache_t *cache);
+cached_resp_t *resp_cache_acquire(resp_cache_t *cache, const ADCSdata *packet, resp_encode_fn encode);
+void resp_cache_release(resp_cache_t *cache, cached_resp_t *resp);
+
+#endif
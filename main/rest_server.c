@@ -8,21 +8,23 @@
 */
 
 #include "comm.h"
+#include "device.h"
+#include "rails.h"
+#include "assetpack.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include "esp_http_server.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_vfs.h"
 #include "cJSON.h"
 #include "driver/gpio.h"
 
-#define GPIO_ENABLE 0
-
 static const char *REST_TAG = "tes-rest";
 
-extern ADCSdata packet_global;
 // extern int num_packets;
 
 #define REST_CHECK(a, str, goto_tag, ...)                                              \
@@ -65,6 +67,31 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     return httpd_resp_set_type(req, type);
 }
 
+#if CONFIG_EXAMPLE_WEB_DEPLOY_PACK
+/* Send HTTP response straight out of the memory-mapped asset pack */
+static esp_err_t rest_common_get_handler(httpd_req_t *req)
+{
+    char filepath[FILE_PATH_MAX];
+    const char *data;
+    size_t len;
+
+    size_t path_len = strcspn(req->uri, "?");
+    if (req->uri[path_len - 1] == '/') {
+        strlcpy(filepath, "/index.html", sizeof(filepath));
+    } else {
+        snprintf(filepath, sizeof(filepath), "%.*s", (int)path_len, req->uri);
+    }
+
+    if (!asset_pack_find(filepath, strlen(filepath), &data, &len)) {
+        ESP_LOGE(REST_TAG, "No such asset : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
+
+    set_content_type_from_file(req, filepath);
+    return httpd_resp_send(req, data, len);
+}
+#else
 /* Send HTTP response with the contents of the requested file */
 static esp_err_t rest_common_get_handler(httpd_req_t *req)
 {
@@ -114,9 +141,35 @@ static esp_err_t rest_common_get_handler(httpd_req_t *req)
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
+#endif
+
+#define ADCS_URI_PREFIX "/api/adcs/"
+
+/* Resolve the device addressed by /api/adcs/{id}/..., optionally returning the rest of the path */
+static adcs_dev_t *device_from_uri(httpd_req_t *req, const char **action)
+{
+    const char *id = req->uri + strlen(ADCS_URI_PREFIX);
+    char *end;
+    long dev_id = strtol(id, &end, 10);
+    if (end == id || *end != '/') {
+        return NULL;
+    }
+    if (action) {
+        *action = end + 1;
+    }
+    return get_device(dev_id);
+}
+
+/* Check whether the rest of a device path names the given action, ignoring any query string */
+static bool uri_action_is(const char *action, const char *name)
+{
+    size_t len = strlen(name);
+    return strncmp(action, name, len) == 0 && (action[len] == '\0' || action[len] == '?');
+}
 
 static esp_err_t adcs_enable_post_handler(httpd_req_t *req)
 {
+    adcs_dev_t *dev = device_from_uri(req, NULL);
     int total_len = req->content_len;
     int cur_len = 0;
     char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
@@ -141,31 +194,45 @@ static esp_err_t adcs_enable_post_handler(httpd_req_t *req)
     int enable = cJSON_GetObjectItem(root, "enable")->valueint;
 
 	// if (!enable)
-	// 	send_command(CMD_STANDBY);
+	// 	send_command(dev, CMD_STANDBY);
 	
-	gpio_set_level(GPIO_ENABLE, enable);
-    ESP_LOGI(REST_TAG, "ADCS enable: %d", enable);
+	gpio_set_level(dev->enable_pin, enable);
+    ESP_LOGI(REST_TAG, "ADCS %d enable: %d", dev->id, enable);
 	cJSON_Delete(root);
 
-	if (enable)
+	if (enable && !dev->enabled)
 	{
-		init_uart();
-		send_command(CMD_HEARTBEAT);
+		if (set_link_enabled(dev, 1) != ESP_OK)
+		{
+			gpio_set_level(dev->enable_pin, 0);
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to set up ADCS link");
+			return ESP_FAIL;
+		}
+		send_command(dev, CMD_HEARTBEAT);
     	httpd_resp_sendstr(req, "Enabled ADCS");
 	}
-	else
+	else if (!enable && dev->enabled)
 	{
-		disable_uart();
-		gpio_set_direction(TXD_PIN, GPIO_MODE_OUTPUT);
-		gpio_set_level(TXD_PIN, 0);
+		if (set_link_enabled(dev, 0) != ESP_OK)
+		{
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to shut down ADCS link");
+			return ESP_FAIL;
+		}
+		gpio_set_direction(dev->txd_pin, GPIO_MODE_OUTPUT);
+		gpio_set_level(dev->txd_pin, 0);
 		httpd_resp_sendstr(req, "Disabled ADCS");
 	}
+	else
+	{
+		httpd_resp_sendstr(req, enable ? "ADCS already enabled" : "ADCS already disabled");
+	}
 
     return ESP_OK;
 }
 
 static esp_err_t adcs_mode_post_handler(httpd_req_t *req)
 {
+    adcs_dev_t *dev = device_from_uri(req, NULL);
     int total_len = req->content_len;
     int cur_len = 0;
     char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
@@ -188,38 +255,46 @@ static esp_err_t adcs_mode_post_handler(httpd_req_t *req)
 
     cJSON *root = cJSON_Parse(buf);
     int mode = cJSON_GetObjectItem(root, "mode")->valueint;
-    ESP_LOGI(REST_TAG, "ADCS mode: %d", mode);
+    ESP_LOGI(REST_TAG, "ADCS %d mode: %d", dev->id, mode);
 	cJSON_Delete(root);
 
+	// a command queued for a disabled link would go out on the next enable
+	if (!dev->enabled)
+	{
+		httpd_resp_set_status(req, "409 Conflict");
+		httpd_resp_sendstr(req, "ADCS link is disabled");
+		return ESP_OK;
+	}
+
 	switch (mode)
 	{
 		case 0:
-		send_command(CMD_STANDBY);
+		send_command(dev, CMD_STANDBY);
     	httpd_resp_sendstr(req, "Set ADCS mode to standby");
 		break;
 
 		case 1:
-		send_command(CMD_HEARTBEAT);
+		send_command(dev, CMD_HEARTBEAT);
 		httpd_resp_sendstr(req, "Set ADCS mode to measure");
 		break;
 
 		case 2:
-		send_command(CMD_TST_SIMPLE_DETUMBLE);
+		send_command(dev, CMD_TST_SIMPLE_DETUMBLE);
 		httpd_resp_sendstr(req, "Initiating detumble test");
 		break;
 
 		case 3:
-		send_command(CMD_TST_BASIC_MOTION);
+		send_command(dev, CMD_TST_BASIC_MOTION);
 		httpd_resp_sendstr(req, "Initiating motion test");
 		break;
 
 		case 4:
-		send_command(CMD_TST_PHOTODIODES);
+		send_command(dev, CMD_TST_PHOTODIODES);
 		httpd_resp_sendstr(req, "Initiating photodiode test");
 		break;
 
 		case 5:
-		send_command(CMD_TST_SIMPLE_ORIENT);
+		send_command(dev, CMD_TST_SIMPLE_ORIENT);
 		httpd_resp_sendstr(req, "Initiating orientation test");
 		break;
 
@@ -231,66 +306,195 @@ static esp_err_t adcs_mode_post_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+static cJSON *packet_to_json(const ADCSdata *packet)
+{
+	cJSON *obj = cJSON_CreateObject();
+	cJSON_AddNumberToObject(obj, "seq", packet->_seq);
+	cJSON_AddNumberToObject(obj, "time", packet->_time / 1000);
+
+	if (packet->_status == STATUS_HELLO)
+		cJSON_AddStringToObject(obj, "status", "HELLO");
+	if (packet->_status == STATUS_OK)
+		cJSON_AddStringToObject(obj, "status", "OK");
+	if (packet->_status == STATUS_COMM_ERROR)
+		cJSON_AddStringToObject(obj, "status", "COMM ERROR");
+	if (packet->_status == STATUS_ADCS_ERROR)
+		cJSON_AddStringToObject(obj, "status", "SYSTEM ERROR");
+	if (packet->_status == STATUS_FUDGED)
+		cJSON_AddStringToObject(obj, "status", "FUDGED");
+
+	cJSON_AddNumberToObject(obj, "voltage", fixedToFloat(packet->_voltage));
+	cJSON_AddNumberToObject(obj, "current", packet->_current);
+	cJSON_AddNumberToObject(obj, "speed", packet->_speed);
+	cJSON_AddNumberToObject(obj, "magx", packet->_magX);
+	cJSON_AddNumberToObject(obj, "magy", packet->_magY);
+	cJSON_AddNumberToObject(obj, "magz", packet->_magZ);
+	cJSON_AddNumberToObject(obj, "gyrox", fixedToFloat(packet->_gyroX));
+	cJSON_AddNumberToObject(obj, "gyroy", fixedToFloat(packet->_gyroY));
+	cJSON_AddNumberToObject(obj, "gyroz", fixedToFloat(packet->_gyroZ));
+	return obj;
+}
+
+static char *encode_packet_json(const ADCSdata *packet)
+{
+	cJSON *obj = packet_to_json(packet);
+	char *data = cJSON_Print(obj);
+	cJSON_Delete(obj);
+	return data;
+}
+
+// random per boot, so ETags cached by browsers before a reboot never match
+static uint32_t etag_nonce;
+
+/*
+ * Handler for the latest packet. Each packet is encoded once and shared by
+ * every request for it; ?fmt=bin selects the binary form. The ETag is keyed on
+ * the boot and the sequence number, so pollers that already have the packet
+ * get a 304. Until the first frame arrives there is nothing to send: 204.
+ */
 static esp_err_t adcs_data_get_handler(httpd_req_t *req)
 {
+    adcs_dev_t *dev = device_from_uri(req, NULL);
 	ADCSdata packet_copy;
-	// const int len = num_packets;
+	char query[32];
+	char param[8];
+	char etag[40];
+	char if_none_match[40];
+	bool binary = false;
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "fmt", param, sizeof(param)) == ESP_OK)
+	{
+		binary = strcmp(param, "bin") == 0;
+	}
 
-	// int i;
-	// for (i = 0; i < len; i++)
-	// {
-	// 	packets_copy[len-i-1] = packets[len-i-1];
-	// 	num_packets--;
-	// }
+	device_get_packet(dev, &packet_copy);
+	if (packet_copy._seq == 0) {
+		httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+		httpd_resp_set_status(req, "204 No Content");
+		return httpd_resp_send(req, NULL, 0);
+	}
 
+	snprintf(etag, sizeof(etag), "\"%08x-%d-%d%s\"", etag_nonce, dev->id, packet_copy._seq, binary ? "b" : "");
+	httpd_resp_set_hdr(req, "ETag", etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+	if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+		strcmp(if_none_match, etag) == 0)
+	{
+		httpd_resp_set_status(req, "304 Not Modified");
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	cached_resp_t *resp = resp_cache_acquire(&dev->data_cache, &packet_copy, encode_packet_json);
+	if (!resp) {
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for response");
+		return ESP_FAIL;
+	}
+
+	esp_err_t ret;
+	int64_t send_start = esp_timer_get_time();
+	if (binary) {
+		httpd_resp_set_type(req, "application/octet-stream");
+		ret = httpd_resp_send(req, (const char *)resp->bin, RESP_BIN_LEN);
+	} else {
+		httpd_resp_set_type(req, "application/json");
+		ret = httpd_resp_send(req, resp->json, resp->json_len);
+	}
+	device_note_client_send(dev, esp_timer_get_time() - send_start);
+
+	resp_cache_release(&dev->data_cache, resp);
+    return ret;
+}
+
+/* Handler for recent packets, optionally only those after ?since=<seq> */
+static esp_err_t adcs_history_get_handler(httpd_req_t *req)
+{
+    adcs_dev_t *dev = device_from_uri(req, NULL);
+	ADCSdata *packets = malloc(ADCS_HISTORY_LEN * sizeof(ADCSdata));
+	int since = -1;
+	char query[32];
+	char param[12];
 	int i;
-	for (i = 0; i < PACKET_LEN; i++)
+
+	if (!packets) {
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for history");
+		return ESP_FAIL;
+	}
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK)
 	{
-		packet_copy._data[i] = packet_global._data[i];
+		since = atoi(param);
 	}
-	packet_copy._seq = packet_global._seq;
+
+	int n = device_get_history(dev, since, packets, ADCS_HISTORY_LEN);
 
     httpd_resp_set_type(req, "application/json");
-	// cJSON *arr = cJSON_CreateArray();
+	cJSON *arr = cJSON_CreateArray();
+	for (i = 0; i < n; i++)
+		cJSON_AddItemToArray(arr, packet_to_json(&packets[i]));
+	free(packets);
 
-	// for (i = 0; i < len; i++)
-	// {
-		cJSON *obj = cJSON_CreateObject();
-		cJSON_AddNumberToObject(obj, "seq", packet_copy._seq);
-		
-		if (packet_copy._status == STATUS_HELLO)
-			cJSON_AddStringToObject(obj, "status", "HELLO");
-		if (packet_copy._status == STATUS_OK)
-			cJSON_AddStringToObject(obj, "status", "OK");
-		if (packet_copy._status == STATUS_COMM_ERROR)
-			cJSON_AddStringToObject(obj, "status", "COMM ERROR");
-		if (packet_copy._status == STATUS_ADCS_ERROR)
-			cJSON_AddStringToObject(obj, "status", "SYSTEM ERROR");
-		if (packet_copy._status == STATUS_FUDGED)
-			cJSON_AddStringToObject(obj, "status", "FUDGED");
-
-		cJSON_AddNumberToObject(obj, "voltage", fixedToFloat(packet_copy._voltage));
-		cJSON_AddNumberToObject(obj, "current", packet_copy._current);
-		cJSON_AddNumberToObject(obj, "speed", packet_copy._speed);
-		cJSON_AddNumberToObject(obj, "magx", packet_copy._magX);
-		cJSON_AddNumberToObject(obj, "magy", packet_copy._magY);
-		cJSON_AddNumberToObject(obj, "magz", packet_copy._magZ);
-		cJSON_AddNumberToObject(obj, "gyrox", fixedToFloat(packet_copy._gyroX));
-		cJSON_AddNumberToObject(obj, "gyroy", fixedToFloat(packet_copy._gyroY));
-		cJSON_AddNumberToObject(obj, "gyroz", fixedToFloat(packet_copy._gyroZ));
-
-		// cJSON_AddItemToArray(arr, obj);
-
-		// cJSON_Delete(obj);
-	// }
-
-
-
-    // cJSON *root = cJSON_CreateObject();
-    // esp_chip_info_t chip_info;
-    // esp_chip_info(&chip_info);
-    // cJSON_AddStringToObject(root, "version", IDF_VER);
-    // cJSON_AddNumberToObject(root, "cores", chip_info.cores);
+    const char *data = cJSON_Print(arr);
+    int64_t send_start = esp_timer_get_time();
+    httpd_resp_sendstr(req, data);
+    device_note_client_send(dev, esp_timer_get_time() - send_start);
+    free((void *)data);
+    cJSON_Delete(arr);
+    return ESP_OK;
+}
+
+static cJSON *device_to_json(adcs_dev_t *dev)
+{
+	adcs_stats_t stats;
+	ADCSdata packet;
+
+	device_get_stats(dev, &stats);
+	device_get_packet(dev, &packet);
+
+	cJSON *obj = cJSON_CreateObject();
+	cJSON_AddNumberToObject(obj, "id", dev->id);
+	cJSON_AddNumberToObject(obj, "uart", dev->uart);
+	cJSON_AddBoolToObject(obj, "enabled", dev->enabled);
+	cJSON_AddNumberToObject(obj, "seq", packet._seq);
+	cJSON_AddNumberToObject(obj, "rx_bytes", stats.rx_bytes);
+	cJSON_AddNumberToObject(obj, "rx_frames", stats.rx_frames);
+	cJSON_AddNumberToObject(obj, "tx_commands", stats.tx_commands);
+	cJSON_AddNumberToObject(obj, "rx_bytes_per_sec", stats.rx_bytes_per_sec);
+	cJSON_AddNumberToObject(obj, "rx_frames_per_sec", stats.rx_frames_per_sec);
+	cJSON_AddNumberToObject(obj, "cpu_percent", stats.cpu_permille / 10.0);
+	cJSON_AddNumberToObject(obj, "client_requests", stats.client_requests);
+	cJSON_AddNumberToObject(obj, "client_requests_per_sec", stats.client_requests_per_sec);
+	cJSON_AddNumberToObject(obj, "client_send_percent", stats.client_send_permille / 10.0);
+	cJSON_AddNumberToObject(obj, "data_encodes", dev->data_cache.builds);
+	cJSON_AddNumberToObject(obj, "data_cache_hits", dev->data_cache.hits);
+
+	flow_ctl_t flow;
+	device_get_flow(dev, &flow);
+	cJSON *fc = cJSON_AddObjectToObject(obj, "flow");
+	cJSON_AddNumberToObject(fc, "level", flow.level);
+	cJSON_AddNumberToObject(fc, "base_rate", flow.base_rate);
+	cJSON_AddNumberToObject(fc, "publish_rate", flow.base_rate >> flow.level);
+	cJSON_AddNumberToObject(fc, "pressure", flow.pressure);
+	cJSON_AddNumberToObject(fc, "ring_fill", flow.ring_fill);
+	cJSON_AddNumberToObject(fc, "client_backlog", dev->client_backlog);
+	cJSON_AddNumberToObject(fc, "decimated", flow.decimated);
+	cJSON_AddNumberToObject(fc, "dropped_bytes", flow.dropped_bytes);
+	cJSON_AddNumberToObject(fc, "overflows", flow.overflows);
+	cJSON_AddNumberToObject(fc, "client_drops", flow.client_drops);
+	cJSON_AddNumberToObject(fc, "rate_down", flow.rate_down);
+	cJSON_AddNumberToObject(fc, "rate_up", flow.rate_up);
+	return obj;
+}
+
+/* Handler for one device's link throughput and CPU usage */
+static esp_err_t adcs_stats_get_handler(httpd_req_t *req)
+{
+    adcs_dev_t *dev = device_from_uri(req, NULL);
+
+    httpd_resp_set_type(req, "application/json");
+	cJSON *obj = device_to_json(dev);
     const char *data = cJSON_Print(obj);
     httpd_resp_sendstr(req, data);
     free((void *)data);
@@ -298,6 +502,281 @@ static esp_err_t adcs_data_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Handler for a compact summary of the current or last test run */
+static esp_err_t adcs_summary_get_handler(httpd_req_t *req)
+{
+    adcs_dev_t *dev = device_from_uri(req, NULL);
+	test_run_t run;
+	int64_t settling;
+	int i;
+
+	test_stats_get(&dev->test, &run);
+	settling = test_run_settling_time(&run);
+
+    httpd_resp_set_type(req, "application/json");
+	cJSON *root = cJSON_CreateObject();
+	cJSON_AddNumberToObject(root, "run", run.run);
+	cJSON_AddBoolToObject(root, "active", run.active);
+	cJSON_AddBoolToObject(root, "complete", run.complete);
+	cJSON_AddNumberToObject(root, "start_seq", run.start_seq);
+	cJSON_AddNumberToObject(root, "end_seq", run.end_seq);
+	cJSON_AddNumberToObject(root, "duration", (run.end_time - run.start_time) / 1000);
+	cJSON_AddNumberToObject(root, "settling", settling < 0 ? -1 : settling / 1000);
+	cJSON_AddNumberToObject(root, "rate", run.rate);
+	cJSON_AddBoolToObject(root, "pass", test_run_passed(&run));
+
+	cJSON *fields = cJSON_AddObjectToObject(root, "fields");
+	for (i = FIELD_STATUS + 1; i < FIELD_COUNT; i++)
+	{
+		const field_stats_t *fs = &run.fields[i];
+		cJSON *obj = cJSON_CreateObject();
+		cJSON_AddNumberToObject(obj, "n", fs->count);
+		cJSON_AddNumberToObject(obj, "mean", fs->mean);
+		cJSON_AddNumberToObject(obj, "var", field_stats_variance(fs));
+		cJSON_AddNumberToObject(obj, "min", fs->min);
+		cJSON_AddNumberToObject(obj, "max", fs->max);
+		cJSON_AddItemToObject(fields, field_name(i), obj);
+	}
+
+    const char *data = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, data);
+    free((void *)data);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* Handler listing every configured device and its link statistics */
+static esp_err_t adcs_devices_get_handler(httpd_req_t *req)
+{
+	int i;
+
+    httpd_resp_set_type(req, "application/json");
+	cJSON *arr = cJSON_CreateArray();
+	for (i = 0; i < num_devices(); i++)
+		cJSON_AddItemToArray(arr, device_to_json(get_device(i)));
+
+    const char *data = cJSON_Print(arr);
+    httpd_resp_sendstr(req, data);
+    free((void *)data);
+    cJSON_Delete(arr);
+    return ESP_OK;
+}
+
+static cJSON *rule_event_to_json(adcs_dev_t *dev, const rule_event_t *event)
+{
+	cJSON *obj = cJSON_CreateObject();
+	cJSON_AddNumberToObject(obj, "device", dev->id);
+	cJSON_AddNumberToObject(obj, "id", event->id);
+	cJSON_AddStringToObject(obj, "rule", rules_get(event->rule)->name);
+	cJSON_AddNumberToObject(obj, "seq", event->seq);
+	cJSON_AddNumberToObject(obj, "time", event->time / 1000);
+	cJSON_AddNumberToObject(obj, "value", event->value);
+	cJSON_AddBoolToObject(obj, "desaturated", event->action & RULE_ACTION_DESATURATE);
+	return obj;
+}
+
+/* Handler for the alarm event log, optionally only events after ?since=<id> */
+static esp_err_t adcs_events_get_handler(httpd_req_t *req)
+{
+    adcs_dev_t *dev = device_from_uri(req, NULL);
+	rule_event_t events[RULE_EVENT_LOG_LEN];
+	uint32_t since = 0;
+	char query[32];
+	char param[12];
+	int i;
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK)
+	{
+		since = strtoul(param, NULL, 10);
+	}
+
+	int n = rules_get_events(&dev->rules, since, events, RULE_EVENT_LOG_LEN);
+
+    httpd_resp_set_type(req, "application/json");
+    cJSON *root = cJSON_CreateObject();
+
+	cJSON *rules = cJSON_AddArrayToObject(root, "rules");
+	for (i = 0; i < rules_count(); i++)
+	{
+		cJSON *obj = cJSON_CreateObject();
+		cJSON_AddStringToObject(obj, "name", rules_get(i)->name);
+		cJSON_AddBoolToObject(obj, "latched", rules_is_latched(&dev->rules, i));
+		cJSON_AddItemToArray(rules, obj);
+	}
+
+	cJSON *arr = cJSON_AddArrayToObject(root, "events");
+	for (i = 0; i < n; i++)
+		cJSON_AddItemToArray(arr, rule_event_to_json(dev, &events[i]));
+
+    const char *data = cJSON_Print(root);
+    httpd_resp_sendstr(req, data);
+    free((void *)data);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+#if CONFIG_HTTPD_WS_SUPPORT
+#define WS_MAX_CLIENTS 4
+
+static httpd_handle_t ws_server;
+static int ws_fds[WS_MAX_CLIENTS] = { -1, -1, -1, -1 };
+
+/* Websocket that pushes alarm events to clients as they happen */
+static esp_err_t adcs_events_ws_handler(httpd_req_t *req)
+{
+	int i;
+
+	if (req->method == HTTP_GET) {
+		/* Handshake done, remember the socket so events can be pushed to it */
+		int fd = httpd_req_to_sockfd(req);
+		for (i = 0; i < WS_MAX_CLIENTS; i++) {
+			if (ws_fds[i] == -1 || ws_fds[i] == fd) {
+				ws_fds[i] = fd;
+				return ESP_OK;
+			}
+		}
+		ESP_LOGW(REST_TAG, "Too many event subscribers, fd %d will not be notified", fd);
+		return ESP_OK;
+	}
+
+	/* Anything the client sends is ignored, but still has to be read off the socket */
+	httpd_ws_frame_t frame;
+	memset(&frame, 0, sizeof(frame));
+	esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+	if (ret != ESP_OK || frame.len == 0) {
+		return ret;
+	}
+	if (frame.len >= SCRATCH_BUFSIZE) {
+		return ESP_FAIL;
+	}
+	frame.payload = (uint8_t *)((rest_server_context_t *)(req->user_ctx))->scratch;
+	return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+/* One queued push: the device is kept so its client backlog can be released */
+typedef struct {
+	adcs_dev_t *dev;
+	char *json;
+} ws_push_t;
+
+static void ws_push_done(ws_push_t *push)
+{
+	adcs_dev_t *dev = push->dev;
+
+	portENTER_CRITICAL(&dev->lock);
+	dev->client_backlog--;
+	portEXIT_CRITICAL(&dev->lock);
+	free(push->json);
+	free(push);
+}
+
+/* Runs in the server task, sends one encoded event to every subscriber */
+static void ws_broadcast_work(void *arg)
+{
+	ws_push_t *push = (ws_push_t *)arg;
+	char *json = push->json;
+	httpd_ws_frame_t frame = {
+		.final = true,
+		.type = HTTPD_WS_TYPE_TEXT,
+		.payload = (uint8_t *)json,
+		.len = strlen(json)
+	};
+	int i;
+
+	for (i = 0; i < WS_MAX_CLIENTS; i++) {
+		if (ws_fds[i] == -1) {
+			continue;
+		}
+		if (httpd_ws_get_fd_info(ws_server, ws_fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET ||
+			httpd_ws_send_frame_async(ws_server, ws_fds[i], &frame) != ESP_OK) {
+			ws_fds[i] = -1;
+		}
+	}
+	ws_push_done(push);
+}
+
+/* Called from a device's receive task whenever one of its rules latches */
+static void rule_event_notify(const rule_event_t *event, void *ctx)
+{
+	adcs_dev_t *dev = (adcs_dev_t *)ctx;
+	bool behind;
+
+	/* Clients that fall behind lose pushes rather than growing the server's work queue;
+	 * the events stay in the log for GET /api/adcs/{id}/events */
+	portENTER_CRITICAL(&dev->lock);
+	behind = dev->client_backlog >= ADCS_CLIENT_BACKLOG_MAX;
+	if (behind) {
+		dev->flow.client_drops++;
+	} else {
+		dev->client_backlog++;
+	}
+	portEXIT_CRITICAL(&dev->lock);
+	if (behind) {
+		return;
+	}
+
+	ws_push_t *push = calloc(1, sizeof(ws_push_t));
+	if (!push) {
+		portENTER_CRITICAL(&dev->lock);
+		dev->client_backlog--;
+		portEXIT_CRITICAL(&dev->lock);
+		return;
+	}
+	push->dev = dev;
+
+	cJSON *obj = rule_event_to_json(dev, event);
+	push->json = cJSON_PrintUnformatted(obj);
+	cJSON_Delete(obj);
+
+	if (!push->json || httpd_queue_work(ws_server, ws_broadcast_work, push) != ESP_OK) {
+		ws_push_done(push);
+	}
+}
+#endif
+
+/* Route GET /api/adcs/{id}/<action> to the handler for that action */
+static esp_err_t adcs_device_get_handler(httpd_req_t *req)
+{
+    const char *action;
+    if (!device_from_uri(req, &action)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such ADCS");
+        return ESP_FAIL;
+    }
+
+    if (uri_action_is(action, "data")) {
+        return adcs_data_get_handler(req);
+    } else if (uri_action_is(action, "history")) {
+        return adcs_history_get_handler(req);
+    } else if (uri_action_is(action, "events")) {
+        return adcs_events_get_handler(req);
+    } else if (uri_action_is(action, "stats")) {
+        return adcs_stats_get_handler(req);
+    } else if (uri_action_is(action, "summary")) {
+        return adcs_summary_get_handler(req);
+    }
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such ADCS resource");
+    return ESP_FAIL;
+}
+
+/* Route POST /api/adcs/{id}/<action> to the handler for that action */
+static esp_err_t adcs_device_post_handler(httpd_req_t *req)
+{
+    const char *action;
+    if (!device_from_uri(req, &action)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such ADCS");
+        return ESP_FAIL;
+    }
+
+    if (uri_action_is(action, "enable")) {
+        return adcs_enable_post_handler(req);
+    } else if (uri_action_is(action, "mode")) {
+        return adcs_mode_post_handler(req);
+    }
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such ADCS resource");
+    return ESP_FAIL;
+}
+
 /* Simple handler for getting system handler */
 static esp_err_t system_info_get_handler(httpd_req_t *req)
 {
@@ -314,12 +793,29 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-/* Simple handler for getting temperature data */
+static cJSON *rail_point_to_json(const rail_point_t *point)
+{
+    cJSON *obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "time", point->time / 1000);
+    for (int r = 0; r < RAIL_COUNT; r++) {
+        cJSON_AddNumberToObject(obj, rail_name(r), point->value[r]);
+    }
+    return obj;
+}
+
+/* Handler for the latest supply rail reading, "raw" feeds the chart view */
 static esp_err_t temperature_data_get_handler(httpd_req_t *req)
 {
+    rail_point_t point;
     httpd_resp_set_type(req, "application/json");
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "raw", esp_random() % 20);
+    cJSON *root;
+    if (rails_get_latest(&point)) {
+        root = rail_point_to_json(&point);
+        cJSON_AddNumberToObject(root, "raw", point.value[RAIL_SUPPLY]);
+    } else {
+        root = cJSON_CreateObject();
+        cJSON_AddNumberToObject(root, "raw", 0);
+    }
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
     free((void *)sys_info);
@@ -327,16 +823,52 @@ static esp_err_t temperature_data_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Handler for decimated rail points, optionally only those after ?since=<ms> */
+static esp_err_t rails_data_get_handler(httpd_req_t *req)
+{
+    rail_point_t *points = malloc(RAILS_HISTORY_LEN * sizeof(rail_point_t));
+    int64_t since = -1;
+    char query[32];
+    char param[16];
+
+    if (!points) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for rail history");
+        return ESP_FAIL;
+    }
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK) {
+        since = strtoll(param, NULL, 10) * 1000 + 999;
+    }
+
+    int n = rails_get_history(since, points, RAILS_HISTORY_LEN);
+
+    httpd_resp_set_type(req, "application/json");
+    cJSON *arr = cJSON_CreateArray();
+    for (int i = 0; i < n; i++) {
+        cJSON_AddItemToArray(arr, rail_point_to_json(&points[i]));
+    }
+    free(points);
+
+    const char *data = cJSON_PrintUnformatted(arr);
+    httpd_resp_sendstr(req, data);
+    free((void *)data);
+    cJSON_Delete(arr);
+    return ESP_OK;
+}
+
 esp_err_t start_rest_server(const char *base_path)
 {
     REST_CHECK(base_path, "wrong base path", err);
     rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
     REST_CHECK(rest_context, "No memory for rest context", err);
     strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
+    etag_nonce = esp_random();
 
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 16;
 
     ESP_LOGI(REST_TAG, "Starting HTTP Server");
     REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
@@ -359,29 +891,57 @@ esp_err_t start_rest_server(const char *base_path)
     };
     httpd_register_uri_handler(server, &temperature_data_get_uri);
 
-	httpd_uri_t adcs_enable_post_uri = {
-        .uri = "/api/adcs/enable",
-        .method = HTTP_POST,
-        .handler = adcs_enable_post_handler,
+    /* URI handler for fetching supply rail history */
+    httpd_uri_t rails_data_get_uri = {
+        .uri = "/api/v1/rails",
+        .method = HTTP_GET,
+        .handler = rails_data_get_handler,
         .user_ctx = rest_context
     };
-    httpd_register_uri_handler(server, &adcs_enable_post_uri);
+    httpd_register_uri_handler(server, &rails_data_get_uri);
 
-	httpd_uri_t adcs_mode_post_uri = {
-        .uri = "/api/adcs/mode",
-        .method = HTTP_POST,
-        .handler = adcs_mode_post_handler,
+    /* URI handler for listing ADCS devices and their link statistics */
+	httpd_uri_t adcs_devices_get_uri = {
+        .uri = "/api/adcs/devices",
+        .method = HTTP_GET,
+        .handler = adcs_devices_get_handler,
         .user_ctx = rest_context
     };
-    httpd_register_uri_handler(server, &adcs_mode_post_uri);
+    httpd_register_uri_handler(server, &adcs_devices_get_uri);
+
+#if CONFIG_HTTPD_WS_SUPPORT
+    /* URI handler for pushing alarm events from every device */
+	httpd_uri_t adcs_events_ws_uri = {
+        .uri = "/api/adcs/events/ws",
+        .method = HTTP_GET,
+        .handler = adcs_events_ws_handler,
+        .user_ctx = rest_context,
+        .is_websocket = true
+    };
+    httpd_register_uri_handler(server, &adcs_events_ws_uri);
 
-	httpd_uri_t adcs_data_get_uri = {
-        .uri = "/api/adcs/data",
+	ws_server = server;
+	for (int i = 0; i < num_devices(); i++) {
+		rules_set_event_cb(&get_device(i)->rules, rule_event_notify, get_device(i));
+	}
+#endif
+
+    /* URI handlers for device-scoped requests, /api/adcs/{id}/... */
+	httpd_uri_t adcs_device_get_uri = {
+        .uri = ADCS_URI_PREFIX "*",
         .method = HTTP_GET,
-        .handler = adcs_data_get_handler,
+        .handler = adcs_device_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &adcs_device_get_uri);
+
+	httpd_uri_t adcs_device_post_uri = {
+        .uri = ADCS_URI_PREFIX "*",
+        .method = HTTP_POST,
+        .handler = adcs_device_post_handler,
         .user_ctx = rest_context
     };
-    httpd_register_uri_handler(server, &adcs_data_get_uri);
+    httpd_register_uri_handler(server, &adcs_device_post_uri);
 
     /* URI handler for getting web server files */
     httpd_uri_t common_get_uri = {
@@ -0,0 +1,285 @@
+#include "rules.h"
+
+#include <string.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "tes-rules";
+
+#if CONFIG_ADCS_RULE_AUTO_DESATURATE
+#define WHEEL_ACTION RULE_ACTION_DESATURATE
+#else
+#define WHEEL_ACTION RULE_ACTION_NONE
+#endif
+
+// rule table shared by every engine; each engine keeps its own rule state
+static const rule_t rules[] = {
+	{
+		.name   = "adcs_error",
+		.kind   = RULE_THRESHOLD,
+		.field  = FIELD_STATUS,
+		.cmp    = RULE_EQUAL,
+		.limit  = STATUS_ADCS_ERROR,
+		.action = RULE_ACTION_NONE
+	},
+	{
+		.name   = "overcurrent",
+		.kind   = RULE_WINDOW,
+		.field  = FIELD_CURRENT,
+		.cmp    = RULE_ABOVE,
+		.limit  = CONFIG_ADCS_RULE_CURRENT_MAX,
+		.window = CONFIG_ADCS_RULE_CURRENT_WINDOW,
+		.action = RULE_ACTION_NONE
+	},
+	{
+		.name   = "wheel_overspeed",
+		.kind   = RULE_THRESHOLD,
+		.field  = FIELD_SPEED,
+		.cmp    = RULE_ABOVE,
+		.limit  = CONFIG_ADCS_RULE_SPEED_MAX,
+		.action = WHEEL_ACTION
+	},
+	{
+		.name   = "wheel_runaway",
+		.kind   = RULE_RATE,
+		.field  = FIELD_SPEED,
+		.cmp    = RULE_ABOVE,
+		.limit  = CONFIG_ADCS_RULE_SPEED_RATE_MAX,
+		.action = WHEEL_ACTION
+	}
+};
+
+#define RATE_MIN_INTERVAL_US ((int64_t)CONFIG_ADCS_RULE_RATE_INTERVAL * 1000)
+
+#define NUM_RULES ((int)(sizeof(rules) / sizeof(rules[0])))
+
+_Static_assert(NUM_RULES <= RULE_MAX, "rule table larger than RULE_MAX");
+_Static_assert(CONFIG_ADCS_RULE_CURRENT_WINDOW <= RULE_WINDOW_MAX, "current window larger than RULE_WINDOW_MAX");
+
+static int compare(enum RuleCmp cmp, float value, float limit)
+{
+	switch (cmp)
+	{
+		case RULE_ABOVE: return value > limit;
+		case RULE_BELOW: return value < limit;
+		case RULE_EQUAL: return value == limit;
+		default:         return 0;
+	}
+}
+
+/**
+ * @brief
+ * Feeds one value into a rule and reports whether its condition holds. Every
+ * rule kind does a constant amount of work per frame: rate rules only keep the
+ * previous sample and window rules keep a running sum over a ring of samples.
+ *
+ * @param[in]     rule   Rule definition
+ * @param[in,out] st     Rule state
+ * @param[in]     value  Latest field value
+ * @param[in]     time   Frame timestamp (us)
+ * @param[out]    eval   Value the condition was evaluated on
+ *
+ * @return 1 if the condition holds, 0 otherwise
+ */
+static int evaluate(const rule_t *rule, rule_state_t *st, float value, int64_t time, float *eval)
+{
+	int hit = 0;
+
+	switch (rule->kind)
+	{
+		case RULE_THRESHOLD:
+		*eval = value;
+		hit = compare(rule->cmp, value, rule->limit);
+		break;
+
+		case RULE_RATE:
+		// measure over at least RATE_MIN_INTERVAL_US, so frames that arrive
+		// close together can't turn one count of change into a huge rate;
+		// until the interval is up the previous verdict stands
+		if (!st->has_prev)
+		{
+			st->prev = value;
+			st->prev_time = time;
+			st->has_prev = 1;
+		}
+		else if (time - st->prev_time >= RATE_MIN_INTERVAL_US)
+		{
+			*eval = fabsf(value - st->prev) * 1e6f / (float)(time - st->prev_time);
+			hit = compare(rule->cmp, *eval, rule->limit);
+			st->prev = value;
+			st->prev_time = time;
+		}
+		else
+		{
+			hit = st->latched;
+		}
+		break;
+
+		case RULE_WINDOW:
+		// field values are integers or multiples of 1/8, so the running sum
+		// stays exact and never has to be rebuilt
+		if (st->fill == rule->window)
+			st->sum -= st->window[st->pos];
+		else
+			st->fill++;
+		st->window[st->pos] = value;
+		st->sum += value;
+		st->pos = (st->pos + 1) % rule->window;
+
+		*eval = st->sum / st->fill;
+		// don't judge the mean until the window is full
+		if (st->fill == rule->window)
+			hit = compare(rule->cmp, *eval, rule->limit);
+		break;
+	}
+
+	return hit;
+}
+
+void rules_init(rule_engine_t *engine)
+{
+	memset(engine, 0, sizeof(*engine));
+	engine->next_id = 1;
+	portMUX_INITIALIZE(&engine->lock);
+}
+
+/**
+ * @brief
+ * Runs every rule against a freshly decoded frame. A rule latches the first
+ * time its condition holds, which logs an event and requests its action; it
+ * re-arms once the condition clears. Nothing slow happens here: the caller
+ * carries out the returned actions first and only then hands the fired events
+ * to rules_dispatch(), so the reaction latency is bounded by the receive loop
+ * rather than by logging, clients or the network stack.
+ *
+ * @param[in,out] engine     Rule engine
+ * @param[in]     packet     Decoded frame
+ * @param[out]    fired      Events that fired on this frame, RULE_MAX entries
+ * @param[out]    num_fired  Number of events written to `fired`
+ *
+ * @return RuleAction bits requested by rules that latched on this frame
+ */
+int rules_process(rule_engine_t *engine, const ADCSdata *packet, rule_event_t *fired, int *num_fired)
+{
+	int actions = 0;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < NUM_RULES; i++)
+	{
+		const rule_t *rule = &rules[i];
+		rule_state_t *st = &engine->state[i];
+		float eval = 0;
+		int hit;
+
+		hit = evaluate(rule, st, get_field(packet, rule->field), packet->_time, &eval);
+
+		if (!hit)
+		{
+			st->latched = 0;
+			continue;
+		}
+		if (st->latched)
+			continue;
+
+		st->latched = 1;
+		actions |= rule->action;
+
+		rule_event_t *event = &fired[n++];
+		event->rule = i;
+		event->seq = packet->_seq;
+		event->time = packet->_time;
+		event->value = eval;
+		event->action = rule->action;
+	}
+
+	*num_fired = n;
+	if (n == 0)
+		return actions;
+
+	portENTER_CRITICAL(&engine->lock);
+	for (i = 0; i < n; i++)
+	{
+		fired[i].id = engine->next_id++;
+		engine->log[fired[i].id % RULE_EVENT_LOG_LEN] = fired[i];
+	}
+	portEXIT_CRITICAL(&engine->lock);
+
+	return actions;
+}
+
+/**
+ * @brief
+ * Logs events returned by rules_process() and passes them to the event
+ * callback. Call this after the events' actions have been carried out.
+ *
+ * @param[in] engine     Rule engine
+ * @param[in] fired      Events from rules_process()
+ * @param[in] num_fired  Number of events
+ */
+void rules_dispatch(rule_engine_t *engine, const rule_event_t *fired, int num_fired)
+{
+	int i;
+
+	for (i = 0; i < num_fired; i++)
+	{
+		ESP_LOGW(TAG, "Rule %s tripped at seq %d (value %f)",
+			rules[fired[i].rule].name, fired[i].seq, fired[i].value);
+		if (engine->event_cb)
+			engine->event_cb(&fired[i], engine->event_ctx);
+	}
+}
+
+void rules_set_event_cb(rule_engine_t *engine, rule_event_cb_t cb, void *ctx)
+{
+	engine->event_cb = cb;
+	engine->event_ctx = ctx;
+}
+
+/**
+ * @brief
+ * Copies logged events newer than `since` out of the event log, oldest first.
+ * Events that have already been overwritten are skipped.
+ *
+ * @param[in]  engine  Rule engine
+ * @param[in]  since   Last event id the caller has seen (0 for everything)
+ * @param[out] out     Destination array
+ * @param[in]  max     Size of the destination array
+ *
+ * @return Number of events copied
+ */
+int rules_get_events(rule_engine_t *engine, uint32_t since, rule_event_t *out, int max)
+{
+	int n = 0;
+	uint32_t id;
+
+	portENTER_CRITICAL(&engine->lock);
+	id = since + 1;
+	if (engine->next_id > RULE_EVENT_LOG_LEN && id < engine->next_id - RULE_EVENT_LOG_LEN)
+		id = engine->next_id - RULE_EVENT_LOG_LEN;
+	for (; id < engine->next_id && n < max; id++)
+		out[n++] = engine->log[id % RULE_EVENT_LOG_LEN];
+	portEXIT_CRITICAL(&engine->lock);
+
+	return n;
+}
+
+int rules_is_latched(rule_engine_t *engine, int rule)
+{
+	if (rule < 0 || rule >= NUM_RULES)
+		return 0;
+	return engine->state[rule].latched;
+}
+
+int rules_count(void)
+{
+	return NUM_RULES;
+}
+
+const rule_t *rules_get(int rule)
+{
+	if (rule < 0 || rule >= NUM_RULES)
+		return NULL;
+	return &rules[rule];
+}
@@ -0,0 +1,94 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "comm.h"
+
+#include "freertos/FreeRTOS.h"
+
+// largest number of rules in the rule table
+#define RULE_MAX           8
+// largest moving-average window a RULE_WINDOW rule may use
+#define RULE_WINDOW_MAX    16
+// number of events kept in the event log before the oldest is overwritten
+#define RULE_EVENT_LOG_LEN 32
+
+enum RuleKind
+{
+	RULE_THRESHOLD,  // compare the latest value against the limit
+	RULE_RATE,       // compare |d(value)/dt| (units per second) against the limit
+	RULE_WINDOW      // compare the mean of the last `window` values against the limit
+};
+
+enum RuleCmp
+{
+	RULE_ABOVE,
+	RULE_BELOW,
+	RULE_EQUAL
+};
+
+// actions a rule may ask the receiver to take when it latches
+enum RuleAction
+{
+	RULE_ACTION_NONE       = 0x00,
+	RULE_ACTION_DESATURATE = 0x01   // send CMD_DESATURATE to the ADCS
+};
+
+typedef struct
+{
+	const char     *name;
+	enum RuleKind   kind;
+	enum Field      field;
+	enum RuleCmp    cmp;
+	float           limit;
+	int             window;
+	enum RuleAction action;
+} rule_t;
+
+typedef struct
+{
+	float   prev;
+	int64_t prev_time;
+	int     has_prev;
+
+	float   window[RULE_WINDOW_MAX];
+	float   sum;
+	int     pos;
+	int     fill;
+
+	int     latched;
+} rule_state_t;
+
+typedef struct
+{
+	uint32_t id;      // monotonically increasing, starting at 1
+	int      rule;    // index into the rule table
+	int      seq;     // sequence number of the frame that tripped the rule
+	int64_t  time;    // frame timestamp (us)
+	float    value;   // value the rule evaluated (raw, rate or window mean)
+	int      action;  // RuleAction bits that were requested
+} rule_event_t;
+
+typedef void (*rule_event_cb_t)(const rule_event_t *event, void *ctx);
+
+typedef struct
+{
+	rule_state_t    state[RULE_MAX];
+	rule_event_t    log[RULE_EVENT_LOG_LEN];
+	uint32_t        next_id;
+	portMUX_TYPE    lock;
+
+	rule_event_cb_t event_cb;
+	void           *event_ctx;
+} rule_engine_t;
+
+void rules_init(rule_engine_t *engine);
+int rules_process(rule_engine_t *engine, const ADCSdata *packet, rule_event_t *fired, int *num_fired);
+void rules_dispatch(rule_engine_t *engine, const rule_event_t *fired, int num_fired);
+void rules_set_event_cb(rule_engine_t *engine, rule_event_cb_t cb, void *ctx);
+int rules_get_events(rule_engine_t *engine, uint32_t since, rule_event_t *out, int max);
+int rules_is_latched(rule_engine_t *engine, int rule);
+
+int rules_count(void);
+const rule_t *rules_get(int rule);
+
+#endif
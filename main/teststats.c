@@ -0,0 +1,143 @@
+#include "teststats.h"
+
+#include <string.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "tes-stats";
+
+// settle band and time limit, menuconfig takes them as integers
+#define SETTLE_RATE     (CONFIG_ADCS_TEST_SETTLE_RATE / 10.0f)
+#define SETTLE_TIME_MAX ((int64_t)CONFIG_ADCS_TEST_SETTLE_TIME_MAX * 1000)
+
+static void field_stats_add(field_stats_t *fs, float value)
+{
+	float delta;
+
+	fs->count++;
+	delta = value - fs->mean;
+	fs->mean += delta / fs->count;
+	fs->m2 += delta * (value - fs->mean);
+
+	if (fs->count == 1 || value < fs->min)
+		fs->min = value;
+	if (fs->count == 1 || value > fs->max)
+		fs->max = value;
+}
+
+static float angular_rate(const ADCSdata *packet)
+{
+	float x = get_field(packet, FIELD_GYRO_X);
+	float y = get_field(packet, FIELD_GYRO_Y);
+	float z = get_field(packet, FIELD_GYRO_Z);
+	return sqrtf(x * x + y * y + z * z);
+}
+
+void test_stats_init(test_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	portMUX_INITIALIZE(&stats->lock);
+}
+
+/**
+ * @brief
+ * Folds one frame into the current test run. STATUS_TEST_START begins a new
+ * run and STATUS_TEST_END closes it; frames outside a run are ignored. The
+ * work per frame is constant, so no samples are kept.
+ *
+ * @param[in,out] stats   Test statistics of the device that sent the frame
+ * @param[in]     packet  Decoded frame
+ */
+void test_stats_process(test_stats_t *stats, const ADCSdata *packet)
+{
+	test_run_t *run = &stats->run;
+	float rate = angular_rate(packet);
+	int finished = 0;
+	int i;
+
+	portENTER_CRITICAL(&stats->lock);
+
+	if (packet->_status == STATUS_TEST_START)
+	{
+		uint32_t num = run->run + 1;
+		memset(run, 0, sizeof(*run));
+		run->run = num;
+		run->active = 1;
+		run->start_seq = packet->_seq;
+		run->start_time = packet->_time;
+		run->settled_since = -1;
+	}
+
+	if (run->active)
+	{
+		// status is not a measurement, so it gets no statistics
+		for (i = FIELD_STATUS + 1; i < FIELD_COUNT; i++)
+			field_stats_add(&run->fields[i], get_field(packet, i));
+
+		run->rate = rate;
+		if (rate > SETTLE_RATE)
+			run->settled_since = -1;
+		else if (run->settled_since < 0)
+			run->settled_since = packet->_time;
+		run->end_seq = packet->_seq;
+		run->end_time = packet->_time;
+
+		if (packet->_status == STATUS_TEST_END)
+		{
+			run->active = 0;
+			run->complete = 1;
+			finished = 1;
+		}
+	}
+
+	portEXIT_CRITICAL(&stats->lock);
+
+	if (finished)
+		ESP_LOGI(TAG, "Test run %u finished: %s", (unsigned)run->run, test_run_passed(run) ? "pass" : "fail");
+}
+
+void test_stats_get(test_stats_t *stats, test_run_t *out)
+{
+	portENTER_CRITICAL(&stats->lock);
+	*out = stats->run;
+	portEXIT_CRITICAL(&stats->lock);
+}
+
+float field_stats_variance(const field_stats_t *fs)
+{
+	if (fs->count < 2)
+		return 0;
+	return fs->m2 / (fs->count - 1);
+}
+
+/**
+ * @brief
+ * Time from the start of a run until the angular rate entered the settle band
+ * for good.
+ *
+ * @param[in] run  Test run
+ *
+ * @return Settling time (us), or -1 if the rate is still outside the band
+ */
+int64_t test_run_settling_time(const test_run_t *run)
+{
+	if (run->run == 0 || run->settled_since < 0)
+		return -1;
+	return run->settled_since - run->start_time;
+}
+
+/**
+ * @brief
+ * A run passes once it has finished with the angular rate inside the settle
+ * band, having settled within the configured time limit.
+ *
+ * @param[in] run  Test run
+ *
+ * @return 1 if the run passed, 0 otherwise
+ */
+int test_run_passed(const test_run_t *run)
+{
+	int64_t settling = test_run_settling_time(run);
+	return run->complete && settling >= 0 && settling <= SETTLE_TIME_MAX;
+}
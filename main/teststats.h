@@ -0,0 +1,47 @@
+#ifndef TESTSTATS_H
+#define TESTSTATS_H
+
+#include "comm.h"
+
+#include "freertos/FreeRTOS.h"
+
+// running statistics for one telemetry field
+typedef struct
+{
+	uint32_t count;
+	float    mean;
+	float    m2;     // sum of squared deviations from the mean (Welford)
+	float    min;
+	float    max;
+} field_stats_t;
+
+// one test run, bounded by STATUS_TEST_START and STATUS_TEST_END
+typedef struct
+{
+	uint32_t      run;             // 0 until the first run starts
+	int           active;          // between TEST_START and TEST_END
+	int           complete;        // TEST_END was seen for this run
+	int           start_seq;
+	int           end_seq;         // last frame folded into the run
+	int64_t       start_time;
+	int64_t       end_time;
+	int64_t       settled_since;   // first frame of the current in-band stretch, -1 while outside the settle band
+	float         rate;            // angular rate magnitude of the last frame (deg/s)
+	field_stats_t fields[FIELD_COUNT];
+} test_run_t;
+
+typedef struct
+{
+	test_run_t   run;
+	portMUX_TYPE lock;
+} test_stats_t;
+
+void test_stats_init(test_stats_t *stats);
+void test_stats_process(test_stats_t *stats, const ADCSdata *packet);
+void test_stats_get(test_stats_t *stats, test_run_t *out);
+
+float field_stats_variance(const field_stats_t *fs);
+int64_t test_run_settling_time(const test_run_t *run);
+int test_run_passed(const test_run_t *run);
+
+#endif
@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+#
+# Packs a built website (front/web-demo/dist) into a flat asset image that the
+# firmware memory-maps from the www partition and serves without a filesystem.
+#
+# Image layout, all integers little endian:
+#
+#   header      magic "WWWP", version (u16), entry count (u16),
+#               slot count (u16), bucket count (u16), seed (u32),
+#               image size (u32)
+#   buckets     bucket count x u16 displacement, padded to 4 bytes
+#   slots       slot count x { path offset (u32), path length (u16),
+#               reserved (u16), data offset (u32), data length (u32) }
+#   paths       NUL-terminated request paths, e.g. "/index.html"
+#   data        file contents, each aligned to 4 bytes
+#
+# Lookup is a hash-and-displace perfect hash: the path hashed with `seed`
+# picks a bucket, and the path hashed with that bucket's displacement picks
+# the slot. Empty slots have a path length of 0. Offsets are from the start
+# of the image.
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b'WWWP'
+VERSION = 1
+HEADER = struct.Struct('<4sHHHHII')
+SLOT = struct.Struct('<IHHII')
+MAX_DISPLACEMENT = 0xffff
+
+
+def fnv1a(seed, data):
+    h = (2166136261 ^ seed) & 0xffffffff
+    for b in data:
+        h ^= b
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+
+def build_table(paths, seed):
+    """Assign every path a slot, returning (slots, displacements) or None."""
+    num_buckets = max(1, (len(paths) + 1) // 2)
+    num_slots = len(paths)
+    buckets = [[] for _ in range(num_buckets)]
+    for p in paths:
+        buckets[fnv1a(seed, p) % num_buckets].append(p)
+
+    while True:
+        slots = [None] * num_slots
+        displacements = [0] * num_buckets
+        ok = True
+        # place the most crowded buckets first, while the table is emptiest
+        for b in sorted(range(num_buckets), key=lambda i: -len(buckets[i])):
+            if not buckets[b]:
+                continue
+            for d in range(1, MAX_DISPLACEMENT + 1):
+                wanted = [fnv1a(d, p) % num_slots for p in buckets[b]]
+                if len(set(wanted)) == len(wanted) and all(slots[s] is None for s in wanted):
+                    for s, p in zip(wanted, buckets[b]):
+                        slots[s] = p
+                    displacements[b] = d
+                    break
+            else:
+                ok = False
+                break
+        if ok:
+            return slots, displacements
+        # no displacement fits, trade a little space for an easier table
+        num_slots += 1
+
+
+def collect(root):
+    files = {}
+    for dirpath, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(dirpath, name)
+            rel = os.path.relpath(full, root).replace(os.sep, '/')
+            with open(full, 'rb') as f:
+                files[('/' + rel).encode('utf-8')] = f.read()
+    return files
+
+
+def pad4(buf):
+    buf.extend(b'\0' * (-len(buf) % 4))
+
+
+def pack(files, seed):
+    paths = sorted(files)
+    slots, displacements = build_table(paths, seed)
+
+    buckets_len = (2 * len(displacements) + 3) & ~3
+    table_len = HEADER.size + buckets_len + SLOT.size * len(slots)
+    blob = bytearray()
+    where = {}
+    for p in paths:
+        path_off = table_len + len(blob)
+        blob.extend(p + b'\0')
+        where[p] = path_off
+    for p in paths:
+        pad4(blob)
+        where[p] = (where[p], table_len + len(blob))
+        blob.extend(files[p])
+    pad4(blob)
+
+    image = bytearray(HEADER.pack(MAGIC, VERSION, len(paths), len(slots),
+                                  len(displacements), seed, table_len + len(blob)))
+    for d in displacements:
+        image.extend(struct.pack('<H', d))
+    pad4(image)
+    for p in slots:
+        if p is None:
+            image.extend(SLOT.pack(0, 0, 0, 0, 0))
+        else:
+            path_off, data_off = where[p]
+            image.extend(SLOT.pack(path_off, len(p), 0, data_off, len(files[p])))
+    image.extend(blob)
+    return image
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack a website into a memory-mappable asset image')
+    parser.add_argument('src_dir', help='directory to pack, e.g. front/web-demo/dist')
+    parser.add_argument('output', help='image file to write')
+    parser.add_argument('--size', type=lambda s: int(s, 0), default=None,
+                        help='partition size, the image must fit in it')
+    parser.add_argument('--seed', type=int, default=0x5eed)
+    args = parser.parse_args()
+
+    files = collect(args.src_dir)
+    if not files:
+        sys.exit('%s is empty' % args.src_dir)
+    if len(files) > 0xffff:
+        sys.exit('too many files (%d)' % len(files))
+
+    image = pack(files, args.seed)
+    if args.size is not None and len(image) > args.size:
+        sys.exit('asset image is %d bytes, partition is only %d' % (len(image), args.size))
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('Packed %d files into %s (%d bytes)' % (len(files), args.output, len(image)))
+
+
+if __name__ == '__main__':
+    main()